@@ -0,0 +1,38 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Inserts ROWS rows in transactions of TXN rows, then reads them back out of
+# the binary log with Mysql2::BinlogStream and reports row events decoded per
+# second. Needs binlog_format=ROW on the server.
+#
+#   ROWS=500000 TXN=1000 ruby benchmark/binlog_stream.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 500_000
+per_transaction = ENV['TXN'] && ENV['TXN'].to_i || 1000
+opts = { :host => "localhost", :username => "root", :database => 'test' }
+
+client = Mysql2::Client.new(opts)
+client.query "DROP TABLE IF EXISTS mysql2_binlog_test"
+client.query "CREATE TABLE mysql2_binlog_test (id INT NOT NULL AUTO_INCREMENT, amount DECIMAL(10,2), created_at DATETIME(6), note VARCHAR(64), PRIMARY KEY (id))"
+status = client.query("SHOW MASTER STATUS").first
+values = (["(12.34, NOW(6), 'a short note about this row')"] * per_transaction).join(',')
+(number_of_rows / per_transaction).times do
+  client.query "INSERT INTO mysql2_binlog_test (amount, created_at, note) VALUES #{values}"
+end
+
+stream = Mysql2::BinlogStream.new(opts.merge(:server_id => 4242, :file => status['File'], :position => status['Position'], :batch_size => 1000))
+rows = 0
+time = Benchmark.realtime do
+  catch(:done) do
+    stream.each_batch do |events|
+      events.each { |event| rows += event[:rows].size if event[:table] == "mysql2_binlog_test" }
+      throw :done if rows >= number_of_rows
+    end
+  end
+end
+stream.close
+puts "#{rows} rows in #{'%.2f' % time}s, #{(rows / time).to_i} rows/s"
@@ -0,0 +1,38 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Reads ROWS rows with a JSON, a tinyint(1) and a BINARY(16) UUID column,
+# converting them in a second pass over each row in Ruby and with :casters.
+#
+#   ROWS=100000 ruby benchmark/casters.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'json'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 100_000
+
+client = Mysql2::Client.new(:host => "localhost", :username => "root", :database => 'test')
+client.query "DROP TABLE IF EXISTS mysql2_casters_test"
+client.query "CREATE TABLE mysql2_casters_test (id INT NOT NULL AUTO_INCREMENT, settings TEXT, active TINYINT(1), uid BINARY(16), PRIMARY KEY (id))"
+client.query %q{INSERT INTO mysql2_casters_test (settings, active, uid) VALUES ('{"theme": "dark", "limits": [1, 2, 3]}', 1, UNHEX(REPLACE(UUID(), '-', '')))}
+while client.query("SELECT COUNT(*) AS c FROM mysql2_casters_test").first['c'] < number_of_rows
+  client.query "INSERT INTO mysql2_casters_test (settings, active, uid) SELECT settings, active, uid FROM mysql2_casters_test"
+end
+
+sql = "SELECT * FROM mysql2_casters_test"
+Benchmark.bmbm do |x|
+  x.report("second pass") do
+    client.query(sql, :cache_rows => false).each do |row|
+      row['settings'] = JSON.parse(row['settings'])
+      row['active'] = row['active'] != 0
+      row['uid'] = row['uid'].unpack('H8H4H4H4H12').join('-')
+    end
+  end
+  x.report(":casters") do
+    client.query(sql, :cache_rows => false, :casters => { 'settings' => :json, 'active' => :boolean, 'uid' => :uuid }).each { |row| }
+  end
+end
+
+client.query "DROP TABLE mysql2_casters_test"
@@ -0,0 +1,40 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Reads ROWS rows of SELECT * from a 60 column table (20 INT, 20 DECIMAL,
+# 20 VARCHAR), building every field and only the 3 named in :columns.
+#
+#   ROWS=50000 ruby benchmark/columns.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 50_000
+
+client = Mysql2::Client.new(:host => "localhost", :username => "root", :database => 'test')
+columns = (1..20).map { |i| ["i#{i} INT", "d#{i} DECIMAL(10,2)", "s#{i} VARCHAR(32)"] }.flatten
+values = (1..20).map { |i| [i, "#{i}.25", "'string #{i}'"] }.flatten
+client.query "DROP TABLE IF EXISTS mysql2_columns_test"
+client.query "CREATE TABLE mysql2_columns_test (id INT NOT NULL AUTO_INCREMENT, #{columns.join(', ')}, PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_columns_test VALUES (NULL, #{values.join(', ')})"
+names = (1..20).map { |i| ["i#{i}", "d#{i}", "s#{i}"] }.flatten.join(', ')
+while client.query("SELECT COUNT(*) AS c FROM mysql2_columns_test").first['c'] < number_of_rows
+  client.query "INSERT INTO mysql2_columns_test (#{names}) SELECT #{names} FROM mysql2_columns_test"
+end
+
+sql = "SELECT * FROM mysql2_columns_test"
+Benchmark.bmbm do |x|
+  x.report("all 61 columns") do
+    client.query(sql, :cache_rows => false).each { |row| row['id'] }
+  end
+  x.report(":columns => 3") do
+    client.query(sql, :cache_rows => false, :columns => ['id', 'd7', 's12']).each { |row| row['id'] }
+  end
+  x.report(":skip_columns => 58") do
+    skipped = names.split(', ') - ['d7', 's12']
+    client.query(sql, :cache_rows => false, :skip_columns => skipped).each { |row| row['id'] }
+  end
+end
+
+client.query "DROP TABLE mysql2_columns_test"
@@ -0,0 +1,49 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Times reading a large, compressible text result without compression,
+# with zlib and (on MySQL 8.0.18+ client libraries) with zstd.
+#
+# Compression only pays off on a slow link, so throttle loopback first:
+#
+#   sudo tc qdisc add dev lo root netem rate 100mbit delay 1ms
+#   MB=200 ruby benchmark/compression.rb
+#   sudo tc qdisc del dev lo root
+#
+# This connects over TCP to 127.0.0.1, the unix socket isn't throttled.
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+total_mb = ENV['MB'] && ENV['MB'].to_i || 200
+database = 'test'
+opts = { :host => "127.0.0.1", :username => "root", :database => database }
+
+client = Mysql2::Client.new(opts)
+client.query "DROP TABLE IF EXISTS mysql2_compression_test"
+client.query "CREATE TABLE mysql2_compression_test (id INT NOT NULL AUTO_INCREMENT, document MEDIUMTEXT, PRIMARY KEY (id))"
+# JSON-ish text, about 64KB per row
+document = (1..800).map { |i| %({"id":#{i},"status":"shipped","tags":["a","b"]}) }.join(',')
+client.query "INSERT INTO mysql2_compression_test (document) VALUES ('[#{client.escape(document)}]')"
+while client.query("SELECT SUM(LENGTH(document)) AS s FROM mysql2_compression_test").first['s'].to_i < total_mb * 1024 * 1024
+  client.query "INSERT INTO mysql2_compression_test (document) SELECT document FROM mysql2_compression_test"
+end
+
+sql = "SELECT document FROM mysql2_compression_test"
+modes = { "uncompressed" => false, "zlib" => true, "zstd" => :zstd }
+Benchmark.bmbm do |x|
+  modes.each do |name, compress|
+    reader = Mysql2::Client.new(opts.merge(:compress => compress))
+    x.report(name) do
+      reader.query(sql, :cache_rows => false).each { |row| }
+    end
+  end
+end
+
+modes.each do |name, compress|
+  reader = Mysql2::Client.new(opts.merge(:compress => compress))
+  before = reader.compression_stats[:bytes_sent]
+  reader.query(sql, :cache_rows => false).each { |row| }
+  puts "#{name}: #{(reader.compression_stats[:bytes_sent] - before) / 1024 / 1024}MB on the wire"
+end
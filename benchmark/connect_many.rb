@@ -0,0 +1,26 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Time until CONNECTIONS clients are ready, connecting one after another
+# vs. Mysql2::Client.connect_many.
+#
+#   CONNECTIONS=50 ruby benchmark/connect_many.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_connections = ENV['CONNECTIONS'] && ENV['CONNECTIONS'].to_i || 50
+opts = { :host => "localhost", :username => "root", :database => 'test' }
+
+Benchmark.bmbm do |x|
+  x.report("serial") do
+    clients = Array.new(number_of_connections) { Mysql2::Client.new(opts) }
+    clients.each { |client| client.close }
+  end
+
+  x.report("connect_many") do
+    clients = Mysql2::Client.connect_many(number_of_connections, opts)
+    clients.each { |client| client.close }
+  end
+end
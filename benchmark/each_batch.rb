@@ -0,0 +1,44 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Reads ROWS rows with :stream => true and with Client#each_batch, with and
+# without WORK seconds of simulated processing per BATCH rows, which
+# each_batch overlaps with fetching the next batch.
+#
+#   ROWS=1000000 BATCH=5000 WORK=0.005 ruby benchmark/each_batch.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 1_000_000
+batch_size = ENV['BATCH'] && ENV['BATCH'].to_i || 5000
+work = ENV['WORK'] && ENV['WORK'].to_f || 0.005
+opts = { :host => "localhost", :username => "root", :database => 'test' }
+
+client = Mysql2::Client.new(opts)
+client.query "DROP TABLE IF EXISTS mysql2_each_batch_test"
+client.query "CREATE TABLE mysql2_each_batch_test (id INT NOT NULL AUTO_INCREMENT, email VARCHAR(64), created_at DATETIME, PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_each_batch_test (email, created_at) VALUES ('someone@example.com', NOW())"
+while client.query("SELECT COUNT(*) AS c FROM mysql2_each_batch_test").first['c'] < number_of_rows
+  client.query "INSERT INTO mysql2_each_batch_test (email, created_at) SELECT email, created_at FROM mysql2_each_batch_test"
+end
+
+sql = "SELECT * FROM mysql2_each_batch_test"
+Benchmark.bmbm do |x|
+  x.report("stream") do
+    rows = 0
+    client.query(sql, :stream => true, :cache_rows => false).each do |row|
+      rows += 1
+      sleep work if rows % batch_size == 0
+    end
+  end
+  x.report("each_batch") do
+    client.each_batch(sql, :key => "id", :batch_size => batch_size) do |result|
+      result.each { |row| }
+      sleep work
+    end
+  end
+end
+
+client.query "DROP TABLE mysql2_each_batch_test"
@@ -0,0 +1,35 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Runs reads in a loop for SECONDS with and without :retry_reads; restart
+# mysqld in another terminal while it runs and compare the errors.
+#
+#   SECONDS=30 ruby benchmark/failover.rb
+#   sudo service mysql restart   # meanwhile
+
+require 'rubygems'
+require 'mysql2'
+
+seconds = ENV['SECONDS'] && ENV['SECONDS'].to_i || 30
+opts = { :host => "localhost", :username => "root", :database => 'test' }
+
+plain = Mysql2::Client.new(opts.merge(:reconnect => true))
+retrying = Mysql2::Client.new(opts.merge(:retry_reads => true, :retry_attempts => 20, :retry_backoff => 0.1))
+retrying.query("SET @session_check = 1")
+
+counts = Hash.new { |h, k| h[k] = Hash.new(0) }
+deadline = Time.now + seconds
+while Time.now < deadline
+  { "reconnect" => plain, "retry_reads" => retrying }.each do |name, client|
+    begin
+      client.query("SELECT 1")
+      counts[name][:ok] += 1
+    rescue Mysql2::Error => e
+      counts[name][:errors] += 1
+    end
+  end
+  sleep 0.01
+end
+
+counts.each { |name, count| puts "#{name}: #{count[:ok]} ok, #{count[:errors]} errors" }
+puts "retry_reads: #{retrying.reconnect_stats.inspect}, session kept: #{retrying.query('SELECT @session_check AS c').first['c'] == 1}"
@@ -0,0 +1,63 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Fans 10 queries out over 10 connections and compares collecting the
+# results one client at a time with Mysql2::Client.wait_any.
+#
+#   ITERATIONS=100 ruby benchmark/fan_out.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_clients = 10
+iterations = ENV['ITERATIONS'] && ENV['ITERATIONS'].to_i || 100
+database = 'test'
+
+clients = Array.new(number_of_clients) do
+  Mysql2::Client.new(:host => "localhost", :username => "root", :database => database)
+end
+# uneven latencies, like queries against different shards
+queries = Array.new(number_of_clients) { |i| "SELECT sleep(#{(i % 4) * 0.005}) AS s, #{i} AS i" }
+
+def fan_out(clients, queries)
+  clients.zip(queries).each { |client, sql| client.query(sql, :async => true) }
+end
+
+Benchmark.bmbm do |x|
+  x.report("async_result in order") do
+    iterations.times do
+      fan_out(clients, queries)
+      clients.each { |client| client.async_result.to_a }
+    end
+  end
+
+  x.report("IO.select + async_result") do
+    ios = clients.map { |client| IO.for_fd(client.socket, :autoclose => false) }
+    iterations.times do
+      fan_out(clients, queries)
+      pending = ios.zip(clients)
+      until pending.empty?
+        readable = IO.select(pending.map { |io, client| io }).first
+        pending.reject! do |io, client|
+          next false unless readable.include?(io)
+          client.async_result.to_a
+          true
+        end
+      end
+    end
+  end
+
+  x.report("Mysql2::Client.wait_any") do
+    iterations.times do
+      fan_out(clients, queries)
+      pending = clients.dup
+      until pending.empty?
+        Mysql2::Client.wait_any(pending).each do |client|
+          client.async_result.to_a
+          pending.delete(client)
+        end
+      end
+    end
+  end
+end
@@ -0,0 +1,38 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Runs the same large query in a loop without keeping the results around and
+# reports peak RSS and GC runs, to see how soon unreachable results are
+# collected now that the MYSQL_RES size is reported to the GC.
+#
+#   MB=500 ITERATIONS=20 ruby benchmark/large_result_rss.rb
+
+raise "peak RSS is read from /proc, this benchmark only runs on Linux" unless File.exist?('/proc/self/status')
+
+require 'rubygems'
+require 'mysql2'
+
+total_mb = ENV['MB'] && ENV['MB'].to_i || 500
+iterations = ENV['ITERATIONS'] && ENV['ITERATIONS'].to_i || 20
+row_kb = 64
+database = 'test'
+
+client = Mysql2::Client.new(:host => "localhost", :username => "root", :database => database)
+client.query "DROP TABLE IF EXISTS mysql2_rss_test"
+client.query "CREATE TABLE mysql2_rss_test (id INT NOT NULL AUTO_INCREMENT, data MEDIUMBLOB, PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_rss_test (data) VALUES (REPEAT('x', #{row_kb * 1024}))"
+while client.query("SELECT COUNT(*) AS c FROM mysql2_rss_test").first['c'] * row_kb < total_mb * 1024
+  client.query "INSERT INTO mysql2_rss_test (data) SELECT data FROM mysql2_rss_test"
+end
+
+def rss_mb(field)
+  File.read('/proc/self/status')[/#{field}:\s+(\d+)/, 1].to_i / 1024
+end
+
+gc_start = GC.count
+iterations.times do |i|
+  # only look at the row count, so the rows themselves never become Ruby objects
+  client.query("SELECT data FROM mysql2_rss_test").count
+  puts "iteration #{i + 1}: RSS #{rss_mb('VmRSS')}MB"
+end
+puts "peak RSS #{rss_mb('VmHWM')}MB, #{GC.count - gc_start} GC runs"
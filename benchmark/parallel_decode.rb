@@ -0,0 +1,58 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Times casting a large mostly numeric/temporal result with different
+# :decode_threads settings.
+#
+#   ROWS=2000000 THREADS=1,2,4,8 ruby benchmark/parallel_decode.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 2_000_000
+thread_counts = (ENV['THREADS'] || '1,2,4,8').split(',').map { |n| n.to_i }
+database = 'test'
+
+client = Mysql2::Client.new(:host => "localhost", :username => "root", :database => database)
+client.query "DROP TABLE IF EXISTS mysql2_decode_test"
+client.query <<-SQL
+  CREATE TABLE mysql2_decode_test (
+    id INT NOT NULL AUTO_INCREMENT,
+    tiny_int TINYINT, small_int SMALLINT, medium_int MEDIUMINT, int_col INT, big_int BIGINT,
+    unsigned_int INT UNSIGNED, year_col YEAR,
+    float_col FLOAT, double_col DOUBLE, real_col DOUBLE,
+    date_col DATE, other_date DATE, datetime_col DATETIME, timestamp_col TIMESTAMP NULL,
+    other_datetime DATETIME,
+    char_col CHAR(10), varchar_col VARCHAR(32), decimal_col DECIMAL(10,3), bool_col TINYINT(1),
+    PRIMARY KEY (id)
+  )
+SQL
+client.query <<-SQL
+  INSERT INTO mysql2_decode_test
+    (tiny_int, small_int, medium_int, int_col, big_int, unsigned_int, year_col, float_col, double_col, real_col,
+     date_col, other_date, datetime_col, timestamp_col, other_datetime, char_col, varchar_col, decimal_col, bool_col)
+  VALUES
+    (12, 1234, 123456, 12345678, 1234567890123, 4000000000, 2010, 1.5, 12345.6789, 0.25,
+     '2010-10-30', '1999-12-31', '2010-10-30 12:30:45', '2010-10-30 12:30:45', '1999-12-31 23:59:59',
+     'abcdefghij', 'a varchar value', 1234.567, 1)
+SQL
+while client.query("SELECT COUNT(*) AS c FROM mysql2_decode_test").first['c'] < number_of_rows
+  client.query <<-SQL
+    INSERT INTO mysql2_decode_test
+      (tiny_int, small_int, medium_int, int_col, big_int, unsigned_int, year_col, float_col, double_col, real_col,
+       date_col, other_date, datetime_col, timestamp_col, other_datetime, char_col, varchar_col, decimal_col, bool_col)
+    SELECT tiny_int, small_int, medium_int, int_col, big_int, unsigned_int, year_col, float_col, double_col, real_col,
+           date_col, other_date, datetime_col, timestamp_col, other_datetime, char_col, varchar_col, decimal_col, bool_col
+    FROM mysql2_decode_test LIMIT #{number_of_rows}
+  SQL
+end
+
+sql = "SELECT * FROM mysql2_decode_test LIMIT #{number_of_rows}"
+Benchmark.bmbm do |x|
+  thread_counts.each do |threads|
+    x.report("decode_threads => #{threads}") do
+      client.query(sql, :decode_threads => threads, :cache_rows => false).each { |row| }
+    end
+  end
+end
@@ -0,0 +1,42 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Reads ROWS rows with Mysql2::ParallelScan over 1 and CONNECTIONS clients,
+# in key order and unordered, and prints the slowest chunk of each run.
+#
+#   ROWS=2000000 CONNECTIONS=4 CHUNK=100000 ruby benchmark/parallel_scan.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 2_000_000
+connections = ENV['CONNECTIONS'] && ENV['CONNECTIONS'].to_i || 4
+chunk_size = ENV['CHUNK'] && ENV['CHUNK'].to_i || 100_000
+opts = { :host => "localhost", :username => "root", :database => 'test' }
+
+client = Mysql2::Client.new(opts)
+client.query "DROP TABLE IF EXISTS mysql2_parallel_scan_test"
+client.query "CREATE TABLE mysql2_parallel_scan_test (id INT NOT NULL AUTO_INCREMENT, amount DECIMAL(10,2), created_at DATETIME, note VARCHAR(64), PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_parallel_scan_test (amount, created_at, note) VALUES (12.34, NOW(), 'a short note about this row')"
+while client.query("SELECT COUNT(*) AS c FROM mysql2_parallel_scan_test").first['c'] < number_of_rows
+  client.query "INSERT INTO mysql2_parallel_scan_test (amount, created_at, note) SELECT amount, created_at, note FROM mysql2_parallel_scan_test"
+end
+
+runs = { "1 client" => [1, true], "#{connections} clients" => [connections, true], "#{connections} clients unordered" => [connections, false] }
+scans = {}
+Benchmark.bmbm do |x|
+  runs.each do |name, (count, ordered)|
+    clients = Mysql2::Client.connect_many(count, opts)
+    scans[name] = Mysql2::ParallelScan.new(clients, "mysql2_parallel_scan_test", "id", chunk_size, :ordered => ordered)
+    x.report(name) do
+      scans[name].each_batch { |rows| }
+    end
+  end
+end
+
+scans.each do |name, scan|
+  slowest = scan.chunk_stats.min_by { |stats| stats[:rows_per_second] || 0 }
+  puts "#{name}: slowest chunk #{slowest[:chunk]} at #{slowest[:rows_per_second].to_i} rows/s"
+end
+client.query "DROP TABLE mysql2_parallel_scan_test"
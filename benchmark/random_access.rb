@@ -0,0 +1,35 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Reads one page of PAGE rows from the middle of a ROWS row result, by
+# walking it with #each and with Result#slice.
+#
+#   ROWS=200000 PAGE=50 ruby benchmark/random_access.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 200_000
+page = ENV['PAGE'] && ENV['PAGE'].to_i || 50
+offset = number_of_rows / 2
+
+client = Mysql2::Client.new(:host => "localhost", :username => "root", :database => 'test')
+client.query "DROP TABLE IF EXISTS mysql2_random_access_test"
+client.query "CREATE TABLE mysql2_random_access_test (id INT NOT NULL AUTO_INCREMENT, amount DECIMAL(10,2), created_at DATETIME, name VARCHAR(64), PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_random_access_test (amount, created_at, name) VALUES (12.34, NOW(), 'some name')"
+while client.query("SELECT COUNT(*) AS c FROM mysql2_random_access_test").first['c'] < number_of_rows
+  client.query "INSERT INTO mysql2_random_access_test (amount, created_at, name) SELECT amount, created_at, name FROM mysql2_random_access_test"
+end
+
+sql = "SELECT * FROM mysql2_random_access_test"
+Benchmark.bmbm do |x|
+  x.report("each") do
+    client.query(sql).each_with_index.select { |row, i| i >= offset && i < offset + page }
+  end
+  x.report("slice") do
+    client.query(sql).slice(offset, page)
+  end
+end
+
+client.query "DROP TABLE mysql2_random_access_test"
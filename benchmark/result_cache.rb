@@ -0,0 +1,34 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Times a reference-table lookup run over and over, straight from the server
+# and with :cache => ttl, where every run after the first is a cache hit.
+#
+#   ROWS=200 NUM=10000 ruby benchmark/result_cache.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of = ENV['NUM'] && ENV['NUM'].to_i || 10000
+rows = ENV['ROWS'] && ENV['ROWS'].to_i || 200
+database = 'test'
+
+client = Mysql2::Client.new(:host => "localhost", :username => "root", :database => database)
+client.query "DROP TABLE IF EXISTS mysql2_result_cache_test"
+client.query "CREATE TABLE mysql2_result_cache_test (id INT NOT NULL, name VARCHAR(64), rate DECIMAL(8,4), PRIMARY KEY (id))"
+values = (0...rows).map { |i| "(#{i}, 'Country #{i}', #{i}.1234)" }
+client.query "INSERT INTO mysql2_result_cache_test VALUES #{values.join(',')}"
+
+sql = "SELECT * FROM mysql2_result_cache_test"
+Benchmark.bmbm do |x|
+  x.report("server") do
+    number_of.times { client.query(sql).each { |row| } }
+  end
+  x.report("cached") do
+    number_of.times { client.query(sql, :cache => 60).each { |row| } }
+  end
+end
+
+p Mysql2::Client.result_cache_stats
+client.query "DROP TABLE mysql2_result_cache_test"
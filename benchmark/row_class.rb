@@ -0,0 +1,42 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Turns ROWS rows into Structs by mapping each Hash row in Ruby, and with
+# :as => the Struct class, reporting time and objects allocated.
+#
+#   ROWS=100000 ruby benchmark/row_class.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 100_000
+
+client = Mysql2::Client.new(:host => "localhost", :username => "root", :database => 'test')
+client.query "DROP TABLE IF EXISTS mysql2_row_class_test"
+client.query "CREATE TABLE mysql2_row_class_test (id INT NOT NULL AUTO_INCREMENT, amount INT, name VARCHAR(64), PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_row_class_test (amount, name) VALUES (42, 'some name')"
+while client.query("SELECT COUNT(*) AS c FROM mysql2_row_class_test").first['c'] < number_of_rows
+  client.query "INSERT INTO mysql2_row_class_test (amount, name) SELECT amount, name FROM mysql2_row_class_test"
+end
+
+Record = Struct.new(:id, :amount, :name)
+sql = "SELECT id, amount, name FROM mysql2_row_class_test"
+
+# needs GC.stat[:total_allocated_objects] (Ruby 2.2 and up)
+def allocations
+  before = GC.stat[:total_allocated_objects]
+  yield
+  GC.stat[:total_allocated_objects] - before
+end
+
+Benchmark.bm(18) do |x|
+  x.report("Hash then Struct") do
+    puts "  #{allocations { client.query(sql, :cache_rows => false).map { |row| Record.new(row['id'], row['amount'], row['name']) } }} objects"
+  end
+  x.report(":as => Record") do
+    puts "  #{allocations { client.query(sql, :cache_rows => false, :as => Record).to_a }} objects"
+  end
+end
+
+client.query "DROP TABLE mysql2_row_class_test"
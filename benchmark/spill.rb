@@ -0,0 +1,47 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Reads a MB megabyte table once stored and once spilled to disk, in separate
+# processes, and reports the time and peak RSS of each. Set SPILL_DIR to put
+# the temporary file somewhere else than $TMPDIR.
+#
+#   MB=500 ruby benchmark/spill.rb
+
+raise "peak RSS is read from /proc, this benchmark only runs on Linux" unless File.exist?('/proc/self/status')
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+total_mb = ENV['MB'] && ENV['MB'].to_i || 500
+spill = ENV['SPILL_DIR'] || true
+row_kb = 16
+opts = { :host => "localhost", :username => "root", :database => 'test' }
+
+client = Mysql2::Client.new(opts)
+client.query "DROP TABLE IF EXISTS mysql2_spill_test"
+client.query "CREATE TABLE mysql2_spill_test (id INT NOT NULL AUTO_INCREMENT, data MEDIUMBLOB, PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_spill_test (data) VALUES (REPEAT('x', #{row_kb * 1024}))"
+while client.query("SELECT COUNT(*) AS c FROM mysql2_spill_test").first['c'] * row_kb < total_mb * 1024
+  client.query "INSERT INTO mysql2_spill_test (data) SELECT data FROM mysql2_spill_test"
+end
+client.close
+
+def run(label, opts, query_opts)
+  pid = fork do
+    client = Mysql2::Client.new(opts)
+    rows = 0
+    time = Benchmark.realtime do
+      result = client.query("SELECT * FROM mysql2_spill_test", query_opts.merge(:cache_rows => false))
+      result.each { |row| rows += 1 }
+    end
+    peak = File.read('/proc/self/status')[/VmHWM:\s+(\d+)/, 1].to_i / 1024
+    puts "#{label}: #{rows} rows in #{time.round(2)}s, peak RSS #{peak}MB"
+  end
+  Process.wait(pid)
+end
+
+run("stored", opts, {})
+run("spilled", opts, :spill => spill)
+
+Mysql2::Client.new(opts).query "DROP TABLE mysql2_spill_test"
@@ -0,0 +1,35 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Connects to a TLS-enabled mysqld CONNECTIONS times in a row and reports
+# the time spent connecting and how many connections resumed the TLS
+# session of an earlier one (MySQL 8.0.29+ client libraries).
+#
+#   CONNECTIONS=200 SSLCA=/path/to/ca.pem ruby benchmark/ssl_connect.rb
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_connections = ENV['CONNECTIONS'] && ENV['CONNECTIONS'].to_i || 200
+opts = { :host => "127.0.0.1", :username => "root", :database => 'test', :ssl_mode => :required }
+opts[:sslca] = ENV['SSLCA'] if ENV['SSLCA']
+
+connect_times = []
+reused = 0
+total = Benchmark.realtime do
+  number_of_connections.times do
+    client = Mysql2::Client.new(opts)
+    info = client.info
+    raise "not connected over SSL, is mysqld set up for it?" unless info[:ssl_cipher]
+    connect_times << info[:connect_time]
+    reused += 1 if info[:ssl_session_reused]
+    client.close
+  end
+end
+
+first = connect_times.first
+connect_times.sort!
+puts "#{number_of_connections} connections in #{'%.3f' % total}s, #{reused} resumed a TLS session"
+puts "first connect (full handshake): #{'%.2f' % (first * 1000)}ms"
+puts "median connect:                 #{'%.2f' % (connect_times[connect_times.size / 2] * 1000)}ms"
@@ -0,0 +1,39 @@
+# encoding: UTF-8
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+# Streams ROWS rows with WORK iterations of busywork per row, without and
+# with :prefetch. Read over TCP (127.0.0.1), and throttle loopback to see
+# the effect of a slow link:
+#
+#   sudo tc qdisc add dev lo root netem rate 100mbit delay 1ms
+#   ROWS=500000 WORK=200 PREFETCH=1000 ruby benchmark/stream_prefetch.rb
+#   sudo tc qdisc del dev lo root
+
+require 'rubygems'
+require 'benchmark'
+require 'mysql2'
+
+number_of_rows = ENV['ROWS'] && ENV['ROWS'].to_i || 500_000
+work = ENV['WORK'] && ENV['WORK'].to_i || 200
+prefetch = ENV['PREFETCH'] && ENV['PREFETCH'].to_i || 1000
+opts = { :host => "127.0.0.1", :username => "root", :database => 'test' }
+
+client = Mysql2::Client.new(opts)
+client.query "DROP TABLE IF EXISTS mysql2_stream_prefetch_test"
+client.query "CREATE TABLE mysql2_stream_prefetch_test (id INT NOT NULL AUTO_INCREMENT, amount DECIMAL(10,2), created_at DATETIME, payload VARCHAR(255), PRIMARY KEY (id))"
+client.query "INSERT INTO mysql2_stream_prefetch_test (amount, created_at, payload) VALUES (12.34, NOW(), REPEAT('x', 200))"
+while client.query("SELECT COUNT(*) AS c FROM mysql2_stream_prefetch_test").first['c'] < number_of_rows
+  client.query "INSERT INTO mysql2_stream_prefetch_test (amount, created_at, payload) SELECT amount, created_at, payload FROM mysql2_stream_prefetch_test"
+end
+
+sql = "SELECT * FROM mysql2_stream_prefetch_test"
+Benchmark.bmbm do |x|
+  x.report("stream") do
+    client.query(sql, :stream => true, :cache_rows => false).each { |row| work.times { } }
+  end
+  x.report("stream + prefetch") do
+    client.query(sql, :stream => true, :cache_rows => false, :prefetch => prefetch).each { |row| work.times { } }
+  end
+end
+
+client.query "DROP TABLE mysql2_stream_prefetch_test"
@@ -0,0 +1,836 @@
+#include <mysql2_ext.h>
+
+#ifdef HAVE_MYSQL_BINLOG_OPEN
+/*
+ * Mysql2::BinlogStream follows the binary log over a client's connection
+ * like a replica does (COM_BINLOG_DUMP, through libmysql's
+ * mysql_binlog_open/mysql_binlog_fetch) and turns the row events of a
+ * binlog_format=ROW server into Hashes. lib/mysql2/binlog_stream.rb sets the
+ * connection up and looks up column names and signedness, which the binlog
+ * doesn't carry.
+ */
+
+VALUE cMysql2BinlogStream;
+extern VALUE mMysql2, cMysql2Client, cMysql2Error;
+static VALUE cBigDecimal, cDate;
+static ID intern_table_columns, intern_new, intern_local, intern_at;
+static VALUE sym_type, sym_insert, sym_update, sym_delete, sym_database, sym_table, sym_rows,
+             sym_before, sym_after, sym_timestamp;
+
+/* the event types we look at, from MySQL's binlog_event.h */
+#define MYSQL2_QUERY_EVENT 2
+#define MYSQL2_ROTATE_EVENT 4
+#define MYSQL2_XID_EVENT 16
+#define MYSQL2_TABLE_MAP_EVENT 19
+#define MYSQL2_WRITE_ROWS_EVENT_V1 23
+#define MYSQL2_UPDATE_ROWS_EVENT_V1 24
+#define MYSQL2_DELETE_ROWS_EVENT_V1 25
+#define MYSQL2_WRITE_ROWS_EVENT 30
+#define MYSQL2_UPDATE_ROWS_EVENT 31
+#define MYSQL2_DELETE_ROWS_EVENT 32
+
+#define MYSQL2_EVENT_HEADER_SIZE 19
+
+/* column types only the binlog uses, older headers may not have them */
+#define MYSQL2_TYPE_TIMESTAMP2 17
+#define MYSQL2_TYPE_DATETIME2 18
+#define MYSQL2_TYPE_TIME2 19
+#define MYSQL2_TYPE_JSON 245
+
+typedef struct {
+  VALUE client;         /* the Mysql2::Client whose connection is streaming */
+  VALUE tables;         /* table id => [database, table, types, metadata, column names, unsigned flags] */
+  MYSQL_RPL rpl;
+  char *file;           /* the binlog file being read, rpl.file_name points here */
+  unsigned long long position;
+  VALUE committedFile;  /* where the last transaction read ended, see #position */
+  unsigned long long committedPosition;
+  int checksum;         /* events end with a CRC32 */
+  int open;
+} mysql2_binlog;
+
+struct nogvl_binlog_args {
+  MYSQL *client;
+  MYSQL_RPL *rpl;
+};
+
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+} mysql2_binlog_reader;
+
+static void rb_mysql_binlog_mark(void * ptr) {
+  mysql2_binlog * b = ptr;
+  rb_gc_mark(b->client);
+  rb_gc_mark(b->tables);
+  rb_gc_mark(b->committedFile);
+}
+
+/* the connection belongs to the client, which closes it */
+static void rb_mysql_binlog_free(void * ptr) {
+  mysql2_binlog * b = ptr;
+  xfree(b->file);
+  xfree(b);
+}
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+static const rb_data_type_t rb_mysql_binlog_type = {
+  "rb_mysql_binlog",
+  {
+    rb_mysql_binlog_mark,
+    rb_mysql_binlog_free,
+    0,
+  },
+  0,
+  0,
+  0
+};
+#define GetMysql2Binlog(obj, sval) TypedData_Get_Struct(obj, mysql2_binlog, &rb_mysql_binlog_type, sval)
+#else
+#define GetMysql2Binlog(obj, sval) Data_Get_Struct(obj, mysql2_binlog, sval)
+#endif
+
+static mysql_client_wrapper *mysql2_binlog_client(mysql2_binlog * b) {
+  mysql_client_wrapper *wrapper;
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+  TypedData_Get_Struct(b->client, mysql_client_wrapper, &rb_mysql_client_type, wrapper);
+#else
+  Data_Get_Struct(b->client, mysql_client_wrapper, wrapper);
+#endif
+  if (wrapper->closed || wrapper->client == NULL) {
+    rb_raise(cMysql2Error, "closed MySQL connection");
+  }
+  return wrapper;
+}
+
+static VALUE rb_mysql_binlog_alloc(VALUE klass) {
+  mysql2_binlog * b;
+  VALUE obj;
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+  obj = TypedData_Make_Struct(klass, mysql2_binlog, &rb_mysql_binlog_type, b);
+#else
+  obj = Data_Make_Struct(klass, mysql2_binlog, rb_mysql_binlog_mark, rb_mysql_binlog_free, b);
+#endif
+  b->client = Qnil;
+  b->tables = rb_hash_new();
+  b->file = NULL;
+  b->position = 0;
+  b->committedFile = Qnil;
+  b->committedPosition = 0;
+  b->checksum = 0;
+  b->open = 0;
+  return obj;
+}
+
+static void mysql2_binlog_need(mysql2_binlog_reader *r, size_t n) {
+  if ((size_t)(r->end - r->p) < n) {
+    rb_raise(cMysql2Error, "truncated binlog event");
+  }
+}
+
+static unsigned long long mysql2_binlog_le(mysql2_binlog_reader *r, size_t n) {
+  unsigned long long v = 0;
+  size_t i;
+
+  mysql2_binlog_need(r, n);
+  for (i = 0; i < n; i++) {
+    v |= (unsigned long long)r->p[i] << (8 * i);
+  }
+  r->p += n;
+  return v;
+}
+
+/* the temporal types are stored big endian so they sort bytewise */
+static unsigned long long mysql2_binlog_be(mysql2_binlog_reader *r, size_t n) {
+  unsigned long long v = 0;
+  size_t i;
+
+  mysql2_binlog_need(r, n);
+  for (i = 0; i < n; i++) {
+    v = (v << 8) | r->p[i];
+  }
+  r->p += n;
+  return v;
+}
+
+static unsigned long long mysql2_binlog_lenenc(mysql2_binlog_reader *r) {
+  unsigned long long first = mysql2_binlog_le(r, 1);
+
+  switch (first) {
+  case 252: return mysql2_binlog_le(r, 2);
+  case 253: return mysql2_binlog_le(r, 3);
+  case 254: return mysql2_binlog_le(r, 8);
+  default:  return first;
+  }
+}
+
+static const unsigned char *mysql2_binlog_bytes(mysql2_binlog_reader *r, size_t n) {
+  const unsigned char *p = r->p;
+  mysql2_binlog_need(r, n);
+  r->p += n;
+  return p;
+}
+
+/* microseconds from the fractional part of a TIME2, DATETIME2 or TIMESTAMP2 with +fsp+ digits */
+static long mysql2_binlog_usec(mysql2_binlog_reader *r, unsigned int fsp) {
+  switch (fsp) {
+  case 1: case 2: return (long)mysql2_binlog_be(r, 1) * 10000;
+  case 3: case 4: return (long)mysql2_binlog_be(r, 2) * 100;
+  case 5: case 6: return (long)mysql2_binlog_be(r, 3);
+  default:        return 0;
+  }
+}
+
+/* DECIMAL is stored as groups of 9 digits in 4 bytes, with shorter groups at either end */
+static VALUE mysql2_binlog_decimal(mysql2_binlog_reader *r, unsigned int precision, unsigned int scale) {
+  static const int dig2bytes[10] = {0, 1, 1, 2, 2, 3, 3, 4, 4, 4};
+  unsigned char buf[40];
+  char digits[100];
+  int intg = precision - scale, intg0 = intg / 9, frac0 = scale / 9;
+  int intg0x = intg % 9, frac0x = scale % 9;
+  int size = intg0 * 4 + dig2bytes[intg0x] + frac0 * 4 + dig2bytes[frac0x];
+  int negative, i, o = 0, start;
+  mysql2_binlog_reader d;
+
+  if (size <= 0 || size > (int)sizeof(buf)) {
+    rb_raise(cMysql2Error, "unsupported DECIMAL(%u,%u) in binlog event", precision, scale);
+  }
+  memcpy(buf, mysql2_binlog_bytes(r, size), size);
+  negative = !(buf[0] & 0x80);
+  buf[0] ^= 0x80;
+  if (negative) {
+    for (i = 0; i < size; i++) {
+      buf[i] ^= 0xFF;
+    }
+  }
+
+  d.p = buf;
+  d.end = buf + size;
+  if (negative) {
+    digits[o++] = '-';
+  }
+  start = o;
+  if (intg0x) {
+    o += sprintf(digits + o, "%0*u", intg0x, (unsigned int)mysql2_binlog_be(&d, dig2bytes[intg0x]));
+  }
+  for (i = 0; i < intg0; i++) {
+    o += sprintf(digits + o, "%09u", (unsigned int)mysql2_binlog_be(&d, 4));
+  }
+  // no leading zeros, but keep one before the point
+  for (i = start; i < o - 1 && digits[i] == '0'; i++);
+  memmove(digits + start, digits + i, o - i);
+  o -= i - start;
+  if (o == start) {
+    digits[o++] = '0';
+  }
+  if (scale) {
+    digits[o++] = '.';
+    for (i = 0; i < frac0; i++) {
+      o += sprintf(digits + o, "%09u", (unsigned int)mysql2_binlog_be(&d, 4));
+    }
+    if (frac0x) {
+      o += sprintf(digits + o, "%0*u", frac0x, (unsigned int)mysql2_binlog_be(&d, dig2bytes[frac0x]));
+    }
+  }
+  return rb_funcall(cBigDecimal, intern_new, 1, rb_str_new(digits, o));
+}
+
+static VALUE mysql2_binlog_time(int negative, unsigned long long hms, long usec) {
+  char buf[32];
+  int len;
+
+  len = sprintf(buf, "%s%02u:%02u:%02u", negative ? "-" : "", (unsigned int)((hms >> 12) & 0x3FF),
+                (unsigned int)((hms >> 6) & 0x3F), (unsigned int)(hms & 0x3F));
+  if (usec) {
+    len += sprintf(buf + len, ".%06ld", usec);
+  }
+  return rb_usascii_str_new(buf, len);
+}
+
+static VALUE mysql2_binlog_string(const unsigned char *data, size_t len, rb_encoding *enc) {
+#ifdef HAVE_RUBY_ENCODING_H
+  if (enc) {
+    return rb_enc_str_new((const char *)data, len, enc);
+  }
+#endif
+  return rb_str_new((const char *)data, len);
+}
+
+/*
+ * One column of a row image, +meta+ is what the table map says about the
+ * column and +isUnsigned+ what information_schema does. Text comes back in
+ * the connection's encoding, BLOB, TEXT, BIT and JSON (MySQL's binary JSON)
+ * columns as binary Strings, since the binlog doesn't tell them apart.
+ */
+static VALUE mysql2_binlog_value(mysql2_binlog_reader *r, unsigned int type, unsigned int meta, int isUnsigned, rb_encoding *enc) {
+  switch (type) {
+  case MYSQL_TYPE_TINY: {
+    unsigned long v = (unsigned long)mysql2_binlog_le(r, 1);
+    return isUnsigned ? ULONG2NUM(v) : INT2FIX((signed char)v);
+  }
+  case MYSQL_TYPE_SHORT: {
+    unsigned long v = (unsigned long)mysql2_binlog_le(r, 2);
+    return isUnsigned ? ULONG2NUM(v) : INT2FIX((short)v);
+  }
+  case MYSQL_TYPE_INT24: {
+    long v = (long)mysql2_binlog_le(r, 3);
+    return LONG2NUM(!isUnsigned && (v & 0x800000) ? v - 0x1000000 : v);
+  }
+  case MYSQL_TYPE_LONG: {
+    unsigned long v = (unsigned long)mysql2_binlog_le(r, 4);
+    return isUnsigned ? ULONG2NUM(v) : LONG2NUM((int)v);
+  }
+  case MYSQL_TYPE_LONGLONG: {
+    unsigned long long v = mysql2_binlog_le(r, 8);
+    return isUnsigned ? ULL2NUM(v) : LL2NUM((long long)v);
+  }
+  case MYSQL_TYPE_FLOAT: {
+    float f;
+    memcpy(&f, mysql2_binlog_bytes(r, 4), 4);
+    return rb_float_new(f);
+  }
+  case MYSQL_TYPE_DOUBLE: {
+    double d;
+    memcpy(&d, mysql2_binlog_bytes(r, 8), 8);
+    return rb_float_new(d);
+  }
+  case MYSQL_TYPE_YEAR: {
+    unsigned int year = (unsigned int)mysql2_binlog_le(r, 1);
+    return INT2FIX(year ? 1900 + year : 0);
+  }
+  case MYSQL_TYPE_NEWDECIMAL:
+    return mysql2_binlog_decimal(r, meta >> 8, meta & 0xFF);
+  case MYSQL_TYPE_DATE:
+  case MYSQL_TYPE_NEWDATE: {
+    unsigned long v = (unsigned long)mysql2_binlog_le(r, 3);
+    if (v == 0) {
+      return Qnil;
+    }
+    return rb_funcall(cDate, intern_new, 3, INT2FIX(v >> 9), INT2FIX((v >> 5) & 15), INT2FIX(v & 31));
+  }
+  case MYSQL_TYPE_TIMESTAMP:
+    return rb_funcall(rb_cTime, intern_at, 1, ULL2NUM(mysql2_binlog_le(r, 4)));
+  case MYSQL2_TYPE_TIMESTAMP2: {
+    unsigned long long sec = mysql2_binlog_be(r, 4);
+    long usec = mysql2_binlog_usec(r, meta);
+    return rb_funcall(rb_cTime, intern_at, 2, ULL2NUM(sec), LONG2NUM(usec));
+  }
+  case MYSQL_TYPE_DATETIME: {
+    unsigned long long v = mysql2_binlog_le(r, 8);
+    unsigned long long date = v / 1000000, time = v % 1000000;
+    if (v == 0) {
+      return Qnil;
+    }
+    return rb_funcall(rb_cTime, intern_local, 6, INT2FIX(date / 10000), INT2FIX(date / 100 % 100), INT2FIX(date % 100),
+                      INT2FIX(time / 10000), INT2FIX(time / 100 % 100), INT2FIX(time % 100));
+  }
+  case MYSQL2_TYPE_DATETIME2: {
+    unsigned long long packed = mysql2_binlog_be(r, 5) - 0x8000000000ULL;
+    unsigned long long ymd = packed >> 17, ym = ymd >> 5, hms = packed & 0x1FFFF;
+    long usec = mysql2_binlog_usec(r, meta);
+    if (ymd == 0) {
+      return Qnil;
+    }
+    return rb_funcall(rb_cTime, intern_local, 7, INT2FIX(ym / 13), INT2FIX(ym % 13), INT2FIX(ymd & 31),
+                      INT2FIX(hms >> 12), INT2FIX((hms >> 6) & 63), INT2FIX(hms & 63), LONG2NUM(usec));
+  }
+  case MYSQL_TYPE_TIME: {
+    unsigned long v = (unsigned long)mysql2_binlog_le(r, 3);
+    return mysql2_binlog_time(0, ((v / 10000) << 12) | ((v / 100 % 100) << 6) | (v % 100), 0);
+  }
+  case MYSQL2_TYPE_TIME2: {
+    // packed like MySQL's my_time_packed_from_binary: the h:m:s bits times 2^24 plus microseconds
+    long long intpart, packed;
+    long frac = 0;
+    if (meta >= 5) {
+      packed = (long long)mysql2_binlog_be(r, 6) - 0x800000000000LL;
+    } else {
+      intpart = (long long)mysql2_binlog_be(r, 3) - 0x800000LL;
+      if (meta >= 1) {
+        int bytes = meta <= 2 ? 1 : 2;
+        frac = (long)mysql2_binlog_be(r, bytes);
+        if (intpart < 0 && frac) {
+          intpart++;
+          frac -= 1L << (8 * bytes);
+        }
+        frac *= meta <= 2 ? 10000 : 100;
+      }
+      packed = intpart * (1LL << 24) + frac;
+    }
+    if (packed < 0) {
+      packed = -packed;
+      return mysql2_binlog_time(1, packed >> 24, (long)(packed % (1LL << 24)));
+    }
+    return mysql2_binlog_time(0, packed >> 24, (long)(packed % (1LL << 24)));
+  }
+  case MYSQL_TYPE_VARCHAR:
+  case MYSQL_TYPE_VAR_STRING: {
+    size_t len = (size_t)mysql2_binlog_le(r, meta < 256 ? 1 : 2);
+    return mysql2_binlog_string(mysql2_binlog_bytes(r, len), len, enc);
+  }
+  case MYSQL_TYPE_STRING:
+  case MYSQL_TYPE_ENUM:
+  case MYSQL_TYPE_SET: {
+    // CHAR, ENUM and SET all say they're MYSQL_TYPE_STRING, the real type is in the metadata
+    unsigned int realType = meta >> 8, maxLength = meta & 0xFF;
+    size_t len;
+    if (realType && (realType & 0x30) != 0x30) {
+      maxLength |= ((realType & 0x30) ^ 0x30) << 4;
+      realType |= 0x30;
+    }
+    if (realType == MYSQL_TYPE_ENUM || realType == MYSQL_TYPE_SET) {
+      // the index of the ENUM value, the bits of the SET values
+      return ULL2NUM(mysql2_binlog_le(r, maxLength));
+    }
+    len = (size_t)mysql2_binlog_le(r, maxLength > 255 ? 2 : 1);
+    return mysql2_binlog_string(mysql2_binlog_bytes(r, len), len, enc);
+  }
+  case MYSQL_TYPE_BIT: {
+    size_t len = (meta >> 8) + ((meta & 0xFF) + 7) / 8;
+    return rb_str_new((const char *)mysql2_binlog_bytes(r, len), len);
+  }
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:
+  case MYSQL_TYPE_GEOMETRY:
+  case MYSQL2_TYPE_JSON: {
+    size_t len = (size_t)mysql2_binlog_le(r, meta);
+    return rb_str_new((const char *)mysql2_binlog_bytes(r, len), len);
+  }
+  default:
+    rb_raise(cMysql2Error, "unsupported column type %u in binlog event", type);
+  }
+  return Qnil;
+}
+
+/* how many bytes of table map metadata a column of +type+ has */
+static int mysql2_binlog_meta_size(unsigned int type) {
+  switch (type) {
+  case MYSQL_TYPE_FLOAT:
+  case MYSQL_TYPE_DOUBLE:
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:
+  case MYSQL_TYPE_GEOMETRY:
+  case MYSQL2_TYPE_JSON:
+  case MYSQL2_TYPE_TIMESTAMP2:
+  case MYSQL2_TYPE_DATETIME2:
+  case MYSQL2_TYPE_TIME2:
+    return 1;
+  case MYSQL_TYPE_VARCHAR:
+  case MYSQL_TYPE_VAR_STRING:
+  case MYSQL_TYPE_BIT:
+  case MYSQL_TYPE_NEWDECIMAL:
+  case MYSQL_TYPE_STRING:
+  case MYSQL_TYPE_ENUM:
+  case MYSQL_TYPE_SET:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * TABLE_MAP_EVENT comes before the row events of every table a transaction
+ * touches. The table id stays the same until the table changes, so each one
+ * is only decoded, and its columns looked up, once.
+ */
+static void mysql2_binlog_table_map(VALUE self, mysql2_binlog * b, mysql2_binlog_reader *r) {
+  VALUE tableId = ULL2NUM(mysql2_binlog_le(r, 6));
+  VALUE database, table, types, metadata, columns, names = Qnil, flags = Qnil, unsignedFlags;
+  unsigned long long numberOfColumns, metaLength, i;
+  const unsigned char *typeBytes;
+  mysql2_binlog_reader meta;
+  unsigned short *values;
+  size_t len;
+
+  if (rb_hash_aref(b->tables, tableId) != Qnil) {
+    return;
+  }
+
+  r->p += 2; // flags
+  len = (size_t)mysql2_binlog_le(r, 1);
+  database = rb_str_new((const char *)mysql2_binlog_bytes(r, len + 1), len);
+  len = (size_t)mysql2_binlog_le(r, 1);
+  table = rb_str_new((const char *)mysql2_binlog_bytes(r, len + 1), len);
+
+  numberOfColumns = mysql2_binlog_lenenc(r);
+  typeBytes = mysql2_binlog_bytes(r, numberOfColumns);
+  types = rb_str_new((const char *)typeBytes, numberOfColumns);
+  metaLength = mysql2_binlog_lenenc(r);
+  meta.p = mysql2_binlog_bytes(r, metaLength);
+  meta.end = meta.p + metaLength;
+
+  metadata = rb_str_new(NULL, numberOfColumns * sizeof(unsigned short));
+  values = (unsigned short *)RSTRING_PTR(metadata);
+  for (i = 0; i < numberOfColumns; i++) {
+    switch (mysql2_binlog_meta_size(typeBytes[i])) {
+    case 1:
+      values[i] = (unsigned short)mysql2_binlog_le(&meta, 1);
+      break;
+    case 2:
+      if (typeBytes[i] == MYSQL_TYPE_VARCHAR || typeBytes[i] == MYSQL_TYPE_VAR_STRING) {
+        values[i] = (unsigned short)mysql2_binlog_le(&meta, 2);
+      } else if (typeBytes[i] == MYSQL_TYPE_BIT) {
+        unsigned int bits = (unsigned int)mysql2_binlog_le(&meta, 1);
+        values[i] = (unsigned short)((mysql2_binlog_le(&meta, 1) << 8) | bits);
+      } else {
+        // (real type or precision) << 8 | (length or scale)
+        values[i] = (unsigned short)mysql2_binlog_be(&meta, 2);
+      }
+      break;
+    default:
+      values[i] = 0;
+    }
+  }
+
+  // [names, unsigned flags], from information_schema
+  columns = rb_funcall(self, intern_table_columns, 2, database, table);
+  if (TYPE(columns) == T_ARRAY && RARRAY_LEN(columns) == 2) {
+    names = rb_ary_entry(columns, 0);
+    flags = rb_ary_entry(columns, 1);
+  }
+  if (TYPE(names) != T_ARRAY || (unsigned long long)RARRAY_LEN(names) != numberOfColumns ||
+      TYPE(flags) != T_ARRAY || (unsigned long long)RARRAY_LEN(flags) != numberOfColumns) {
+    // the table changed since this event was written, decoding it with
+    // today's columns would mislabel or misread values
+    rb_raise(cMysql2Error, "%s.%s doesn't have the columns its binlog events have, it changed since they were written",
+             StringValueCStr(database), StringValueCStr(table));
+  }
+  unsignedFlags = rb_str_new(NULL, numberOfColumns);
+  for (i = 0; i < numberOfColumns; i++) {
+    RSTRING_PTR(unsignedFlags)[i] = RTEST(rb_ary_entry(flags, i)) ? 1 : 0;
+  }
+  rb_hash_aset(b->tables, tableId, rb_ary_new3(6, database, table, types, metadata, names, unsignedFlags));
+}
+
+static VALUE mysql2_binlog_row(mysql2_binlog_reader *r, VALUE map, const unsigned char *present,
+                               unsigned long long numberOfColumns, rb_encoding *enc) {
+  const unsigned char *types = (const unsigned char *)RSTRING_PTR(rb_ary_entry(map, 2));
+  const unsigned short *metadata = (const unsigned short *)RSTRING_PTR(rb_ary_entry(map, 3));
+  VALUE names = rb_ary_entry(map, 4);
+  const char *unsignedFlags = RSTRING_PTR(rb_ary_entry(map, 5));
+  VALUE row = rb_hash_new();
+  const unsigned char *nulls;
+  unsigned long long i, numberPresent = 0, n = 0;
+
+  for (i = 0; i < numberOfColumns; i++) {
+    if (present[i / 8] & (1 << (i % 8))) {
+      numberPresent++;
+    }
+  }
+  nulls = mysql2_binlog_bytes(r, (numberPresent + 7) / 8);
+
+  for (i = 0; i < numberOfColumns; i++) {
+    VALUE val = Qnil;
+    if (!(present[i / 8] & (1 << (i % 8)))) {
+      continue;
+    }
+    if (!(nulls[n / 8] & (1 << (n % 8)))) {
+      val = mysql2_binlog_value(r, types[i], metadata[i], unsignedFlags[i], enc);
+    }
+    n++;
+    rb_hash_aset(row, rb_ary_entry(names, i), val);
+  }
+  return row;
+}
+
+/* WRITE_ROWS, UPDATE_ROWS and DELETE_ROWS, version 1 (5.1 to 5.6) or 2 */
+static VALUE mysql2_binlog_rows(mysql2_binlog * b, mysql2_binlog_reader *r, unsigned int type, VALUE timestamp, rb_encoding *enc) {
+  VALUE tableId = ULL2NUM(mysql2_binlog_le(r, 6));
+  VALUE map = rb_hash_aref(b->tables, tableId);
+  VALUE event, rows, kind;
+  unsigned long long numberOfColumns, bitmapSize;
+  const unsigned char *present, *presentAfter = NULL;
+  int update = type == MYSQL2_UPDATE_ROWS_EVENT || type == MYSQL2_UPDATE_ROWS_EVENT_V1;
+
+  if (NIL_P(map)) {
+    // #position only ever points between transactions, so the table map
+    // always comes first
+    rb_raise(cMysql2Error, "binlog row event without a table map, the stream didn't start at a transaction boundary");
+  }
+
+  r->p += 2; // flags
+  if (type >= MYSQL2_WRITE_ROWS_EVENT) {
+    unsigned long long extra = mysql2_binlog_le(r, 2);
+    mysql2_binlog_bytes(r, extra >= 2 ? extra - 2 : 0);
+  }
+  numberOfColumns = mysql2_binlog_lenenc(r);
+  if ((unsigned long long)RSTRING_LEN(rb_ary_entry(map, 2)) != numberOfColumns) {
+    rb_raise(cMysql2Error, "row event doesn't match its table map");
+  }
+  bitmapSize = (numberOfColumns + 7) / 8;
+  present = mysql2_binlog_bytes(r, bitmapSize);
+  if (update) {
+    presentAfter = mysql2_binlog_bytes(r, bitmapSize);
+  }
+
+  rows = rb_ary_new();
+  while (r->p < r->end) {
+    VALUE row = mysql2_binlog_row(r, map, present, numberOfColumns, enc);
+    if (update) {
+      VALUE change = rb_hash_new();
+      rb_hash_aset(change, sym_before, row);
+      rb_hash_aset(change, sym_after, mysql2_binlog_row(r, map, presentAfter, numberOfColumns, enc));
+      row = change;
+    }
+    rb_ary_push(rows, row);
+  }
+
+  if (update) {
+    kind = sym_update;
+  } else if (type == MYSQL2_WRITE_ROWS_EVENT || type == MYSQL2_WRITE_ROWS_EVENT_V1) {
+    kind = sym_insert;
+  } else {
+    kind = sym_delete;
+  }
+
+  event = rb_hash_new();
+  rb_hash_aset(event, sym_type, kind);
+  rb_hash_aset(event, sym_database, rb_ary_entry(map, 0));
+  rb_hash_aset(event, sym_table, rb_ary_entry(map, 1));
+  rb_hash_aset(event, sym_rows, rows);
+  rb_hash_aset(event, sym_timestamp, timestamp);
+  return event;
+}
+
+static VALUE nogvl_binlog_open(void *ptr) {
+  struct nogvl_binlog_args *args = ptr;
+  return mysql_binlog_open(args->client, args->rpl) ? Qfalse : Qtrue;
+}
+
+static VALUE nogvl_binlog_fetch(void *ptr) {
+  struct nogvl_binlog_args *args = ptr;
+  return mysql_binlog_fetch(args->client, args->rpl) ? Qfalse : Qtrue;
+}
+
+/* call-seq: stream._open(client, file, position, server_id, checksum)
+ *
+ * Starts streaming the binlog on +client+'s connection. +checksum+ says
+ * whether the server was told to append CRC32s to the events.
+ */
+static VALUE rb_mysql_binlog_open(VALUE self, VALUE client, VALUE file, VALUE position, VALUE serverId, VALUE checksum) {
+  mysql2_binlog * b;
+  mysql_client_wrapper *wrapper;
+  struct nogvl_binlog_args args;
+
+  GetMysql2Binlog(self, b);
+  if (b->open) {
+    rb_raise(cMysql2Error, "this binlog stream is already open");
+  }
+  b->client = client;
+  wrapper = mysql2_binlog_client(b);
+
+  StringValue(file);
+  xfree(b->file);
+  b->file = ALLOC_N(char, RSTRING_LEN(file) + 1);
+  memcpy(b->file, RSTRING_PTR(file), RSTRING_LEN(file));
+  b->file[RSTRING_LEN(file)] = '\0';
+  b->position = NUM2ULL(position);
+  b->committedFile = rb_str_new2(b->file);
+  b->committedPosition = b->position;
+  b->checksum = RTEST(checksum);
+
+  memset(&b->rpl, 0, sizeof(b->rpl));
+  b->rpl.file_name = b->file;
+  b->rpl.file_name_length = RSTRING_LEN(file);
+  b->rpl.start_position = b->position;
+  b->rpl.server_id = NUM2UINT(serverId);
+  b->rpl.flags = 0;
+
+  args.client = wrapper->client;
+  args.rpl = &b->rpl;
+  if (rb_thread_blocking_region(nogvl_binlog_open, &args, MYSQL2_CLIENT_UBF(wrapper), wrapper->client) == Qfalse) {
+    rb_raise(cMysql2Error, "%s", mysql_error(wrapper->client));
+  }
+  b->open = 1;
+  return self;
+}
+
+/* the end of a transaction (or statement outside one), where a stream can be resumed */
+static void mysql2_binlog_commit(mysql2_binlog * b, unsigned long long logPosition) {
+  if (logPosition) {
+    b->position = logPosition;
+  }
+  b->committedFile = rb_str_new2(b->file);
+  b->committedPosition = b->position;
+}
+
+/* whether a QUERY_EVENT is the BEGIN of a transaction rather than a COMMIT or a DDL statement */
+static int mysql2_binlog_is_begin(mysql2_binlog_reader *r) {
+  unsigned long long schemaLength, statusLength;
+
+  r->p += 8; // thread id, execution time
+  schemaLength = mysql2_binlog_le(r, 1);
+  r->p += 2; // error code
+  statusLength = mysql2_binlog_le(r, 2);
+  mysql2_binlog_bytes(r, statusLength + schemaLength + 1);
+  return r->end - r->p == 5 && memcmp(r->p, "BEGIN", 5) == 0;
+}
+
+/* call-seq: stream._fetch(max)
+ *
+ * Reads events until +max+ row events have been decoded or a transaction
+ * ends with at least one, and returns them. nil once the server has
+ * stopped sending.
+ */
+static VALUE rb_mysql_binlog_fetch(VALUE self, VALUE maxValue) {
+  mysql2_binlog * b;
+  mysql_client_wrapper *wrapper;
+  struct nogvl_binlog_args args;
+  VALUE events = rb_ary_new();
+  long max = NUM2LONG(maxValue);
+  rb_encoding *enc = NULL;
+
+  GetMysql2Binlog(self, b);
+  if (!b->open) {
+    rb_raise(cMysql2Error, "this binlog stream isn't open");
+  }
+  wrapper = mysql2_binlog_client(b);
+  args.client = wrapper->client;
+  args.rpl = &b->rpl;
+#ifdef HAVE_RUBY_ENCODING_H
+  if (!NIL_P(wrapper->encoding)) {
+    enc = rb_to_encoding(wrapper->encoding);
+  }
+#endif
+
+  while (RARRAY_LEN(events) < max) {
+    mysql2_binlog_reader r;
+    unsigned int type;
+    unsigned long long logPosition;
+    VALUE timestamp;
+
+    if (rb_thread_blocking_region(nogvl_binlog_fetch, &args, MYSQL2_CLIENT_UBF(wrapper), wrapper->client) == Qfalse) {
+      b->open = 0;
+      rb_raise(cMysql2Error, "%s", mysql_error(wrapper->client));
+    }
+    if (b->rpl.size == 0) {
+      // end of the stream
+      b->open = 0;
+      return RARRAY_LEN(events) ? events : Qnil;
+    }
+
+    // the packet starts with an OK byte
+    r.p = b->rpl.buffer + 1;
+    r.end = b->rpl.buffer + b->rpl.size;
+    if (b->checksum) {
+      r.end -= 4;
+    }
+    if (r.end - r.p < MYSQL2_EVENT_HEADER_SIZE) {
+      continue;
+    }
+    timestamp = rb_funcall(rb_cTime, intern_at, 1, ULL2NUM(mysql2_binlog_le(&r, 4)));
+    type = (unsigned int)mysql2_binlog_le(&r, 1);
+    r.p += 8; // server id, event size
+    logPosition = mysql2_binlog_le(&r, 4);
+    r.p += 2; // flags
+
+    switch (type) {
+    case MYSQL2_ROTATE_EVENT: {
+      unsigned long long position = mysql2_binlog_le(&r, 8);
+      size_t len = r.end - r.p;
+      xfree(b->file);
+      b->file = ALLOC_N(char, len + 1);
+      memcpy(b->file, r.p, len);
+      b->file[len] = '\0';
+      b->position = position;
+      // table ids are only unique within one file, and files only change between transactions
+      rb_hash_clear(b->tables);
+      mysql2_binlog_commit(b, 0);
+      continue;
+    }
+    case MYSQL2_QUERY_EVENT:
+      if (mysql2_binlog_is_begin(&r)) {
+        break;
+      }
+      // COMMIT of a non-transactional table, or DDL
+      mysql2_binlog_commit(b, logPosition);
+      if (RARRAY_LEN(events)) {
+        return events;
+      }
+      continue;
+    case MYSQL2_TABLE_MAP_EVENT:
+      mysql2_binlog_table_map(self, b, &r);
+      break;
+    case MYSQL2_WRITE_ROWS_EVENT:
+    case MYSQL2_UPDATE_ROWS_EVENT:
+    case MYSQL2_DELETE_ROWS_EVENT:
+    case MYSQL2_WRITE_ROWS_EVENT_V1:
+    case MYSQL2_UPDATE_ROWS_EVENT_V1:
+    case MYSQL2_DELETE_ROWS_EVENT_V1: {
+      VALUE event;
+      if (logPosition) {
+        b->position = logPosition;
+      }
+      event = mysql2_binlog_rows(b, &r, type, timestamp, enc);
+      if (!NIL_P(event)) {
+        rb_ary_push(events, event);
+      }
+      continue;
+    }
+    case MYSQL2_XID_EVENT:
+      mysql2_binlog_commit(b, logPosition);
+      if (RARRAY_LEN(events)) {
+        return events;
+      }
+      continue;
+    }
+    if (logPosition) {
+      b->position = logPosition;
+    }
+  }
+  return events;
+}
+
+/* call-seq: stream.position
+ *
+ * [file, position] at the end of the last transaction read, where a new
+ * stream can pick up. A batch cut short by :batch_size leaves this before
+ * its transaction, so a stream resumed from here reads all of it again.
+ */
+static VALUE rb_mysql_binlog_position(VALUE self) {
+  mysql2_binlog * b;
+
+  GetMysql2Binlog(self, b);
+  if (NIL_P(b->committedFile)) {
+    return Qnil;
+  }
+  return rb_ary_new3(2, rb_str_dup(b->committedFile), ULL2NUM(b->committedPosition));
+}
+
+void init_mysql2_binlog() {
+  cBigDecimal = rb_const_get(rb_cObject, rb_intern("BigDecimal"));
+  rb_global_variable(&cBigDecimal);
+  cDate = rb_const_get(rb_cObject, rb_intern("Date"));
+  rb_global_variable(&cDate);
+
+  cMysql2BinlogStream = rb_define_class_under(mMysql2, "BinlogStream", rb_cObject);
+  rb_define_alloc_func(cMysql2BinlogStream, rb_mysql_binlog_alloc);
+  rb_define_method(cMysql2BinlogStream, "position", rb_mysql_binlog_position, 0);
+  rb_define_private_method(cMysql2BinlogStream, "_open", rb_mysql_binlog_open, 5);
+  rb_define_private_method(cMysql2BinlogStream, "_fetch", rb_mysql_binlog_fetch, 1);
+
+  intern_table_columns = rb_intern("table_columns");
+  intern_new           = rb_intern("new");
+  intern_local         = rb_intern("local");
+  intern_at            = rb_intern("at");
+
+  sym_type      = ID2SYM(rb_intern("type"));
+  sym_insert    = ID2SYM(rb_intern("insert"));
+  sym_update    = ID2SYM(rb_intern("update"));
+  sym_delete    = ID2SYM(rb_intern("delete"));
+  sym_database  = ID2SYM(rb_intern("database"));
+  sym_table     = ID2SYM(rb_intern("table"));
+  sym_rows      = ID2SYM(rb_intern("rows"));
+  sym_before    = ID2SYM(rb_intern("before"));
+  sym_after     = ID2SYM(rb_intern("after"));
+  sym_timestamp = ID2SYM(rb_intern("timestamp"));
+}
+#else
+void init_mysql2_binlog() {
+}
+#endif
@@ -0,0 +1,6 @@
+#ifndef MYSQL2_BINLOG_H
+#define MYSQL2_BINLOG_H
+
+void init_mysql2_binlog();
+
+#endif
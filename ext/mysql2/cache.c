@@ -0,0 +1,362 @@
+#include <mysql2_ext.h>
+#include <ctype.h>
+#include <sys/time.h>
+
+extern VALUE cMysql2Client;
+
+/*
+ * Process-wide cache for the results of queries run with :cache => ttl.
+ *
+ * Entries keep the MYSQL_RES libmysql stored the rows in, field metadata
+ * and row bytes as read off the wire, so a hit never touches the server and
+ * its rows are cast exactly like those of any other result. Entries are kept
+ * in least-recently-used order and the oldest are evicted once their total
+ * size goes over the budget. Every Mysql2::Result reading an entry holds a
+ * reference to it, so entries dropped from the cache are only freed once the
+ * last of those is done with them.
+ *
+ * Everything here runs with the GVL held, which is what serializes access.
+ */
+#define MYSQL2_CACHE_DEFAULT_BUDGET (32 * 1024 * 1024)
+
+struct mysql2_cache_entry {
+  char *key;
+  MYSQL_RES *result;
+  size_t bytes;
+  double expiresAt;
+  unsigned long refs;
+  char cached;      /* 0 once evicted, expired or invalidated */
+  char *tables;     /* "db.table\0table\0...\0", the tables the rows came from */
+  size_t tablesLen;
+  mysql2_cache_entry *newer, *older;
+};
+
+static st_table *entries;
+static mysql2_cache_entry *newest, *oldest;
+static size_t bytesUsed, budget = MYSQL2_CACHE_DEFAULT_BUDGET;
+static unsigned long hits, misses, evictions, expirations, invalidations;
+static VALUE sym_hits, sym_misses, sym_evictions, sym_expirations, sym_invalidations, sym_entries, sym_bytes, sym_budget;
+
+static double mysql2_cache_now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void mysql2_cache_unlink(mysql2_cache_entry *entry) {
+  if (entry->newer) {
+    entry->newer->older = entry->older;
+  } else {
+    newest = entry->older;
+  }
+  if (entry->older) {
+    entry->older->newer = entry->newer;
+  } else {
+    oldest = entry->newer;
+  }
+  entry->newer = entry->older = NULL;
+}
+
+static void mysql2_cache_push(mysql2_cache_entry *entry) {
+  entry->older = newest;
+  entry->newer = NULL;
+  if (newest) {
+    newest->newer = entry;
+  } else {
+    oldest = entry;
+  }
+  newest = entry;
+}
+
+static void mysql2_cache_free_entry(mysql2_cache_entry *entry) {
+  mysql_free_result(entry->result);
+  xfree(entry->key);
+  xfree(entry->tables);
+  xfree(entry);
+}
+
+/* drops an entry from the cache, Results still reading it keep it alive */
+static void mysql2_cache_remove(mysql2_cache_entry *entry) {
+  st_data_t key = (st_data_t)entry->key;
+
+  st_delete(entries, &key, NULL);
+  mysql2_cache_unlink(entry);
+  bytesUsed -= entry->bytes;
+  entry->cached = 0;
+  if (entry->refs == 0) {
+    mysql2_cache_free_entry(entry);
+  }
+}
+
+static void mysql2_cache_evict_to(size_t size) {
+  while (oldest && bytesUsed > size) {
+    mysql2_cache_remove(oldest);
+    evictions++;
+  }
+}
+
+static void mysql2_cache_add_table(mysql2_cache_entry *entry, const char *db, size_t dbLen, const char *table, size_t tableLen) {
+  size_t len = (dbLen ? dbLen + 1 : 0) + tableLen + 1;
+  char *dst;
+
+  if (tableLen == 0) {
+    return;
+  }
+  REALLOC_N(entry->tables, char, entry->tablesLen + len);
+  dst = entry->tables + entry->tablesLen;
+  if (dbLen) {
+    memcpy(dst, db, dbLen);
+    dst[dbLen] = '.';
+    dst += dbLen + 1;
+  }
+  memcpy(dst, table, tableLen);
+  dst[tableLen] = '\0';
+  entry->tablesLen += len;
+}
+
+static int mysql2_cache_keyword_at(const char *sql, long len, long i, const char *word, long wordLen) {
+  if (i + wordLen >= len || strncasecmp(sql + i, word, wordLen) != 0) {
+    return 0;
+  }
+  if (i > 0 && (isalnum((unsigned char)sql[i - 1]) || sql[i - 1] == '_')) {
+    return 0;
+  }
+  return isspace((unsigned char)sql[i + wordLen]) || sql[i + wordLen] == '`';
+}
+
+/*
+ * Columns computed from expressions carry no org_table, so the names after
+ * FROM and JOIN are picked out of the SQL as well. This only needs to be
+ * good enough to make invalidate(table) catch the common cases, anything
+ * it misses still goes away when its TTL runs out.
+ */
+static void mysql2_cache_scan_tables(mysql2_cache_entry *entry, const char *sql, long len) {
+  long i, start;
+  char name[256];
+  size_t nameLen;
+
+  for (i = 0; i < len; i++) {
+    if (!mysql2_cache_keyword_at(sql, len, i, "from", 4) && !mysql2_cache_keyword_at(sql, len, i, "join", 4)) {
+      continue;
+    }
+    i += 4;
+    while (i < len && isspace((unsigned char)sql[i])) {
+      i++;
+    }
+    nameLen = 0;
+    for (start = i; i < len && nameLen < sizeof(name); i++) {
+      unsigned char c = sql[i];
+      if (c == '`') {
+        continue;
+      }
+      if (!isalnum(c) && c != '_' && c != '$' && c != '.' && c < 0x80) {
+        break;
+      }
+      name[nameLen++] = c;
+    }
+    if (i > start && nameLen < sizeof(name)) {
+      mysql2_cache_add_table(entry, NULL, 0, name, nameLen);
+    }
+  }
+}
+
+static void mysql2_cache_collect_tables(mysql2_cache_entry *entry, const char *sql, long sql_len) {
+  MYSQL_FIELD *fields = mysql_fetch_fields(entry->result);
+  unsigned int i, numberOfFields = mysql_num_fields(entry->result);
+
+  for (i = 0; i < numberOfFields; i++) {
+    if (fields[i].org_table && fields[i].org_table[0]) {
+      mysql2_cache_add_table(entry, fields[i].db, fields[i].db ? strlen(fields[i].db) : 0,
+                             fields[i].org_table, strlen(fields[i].org_table));
+    }
+  }
+  mysql2_cache_scan_tables(entry, sql, sql_len);
+}
+
+/*
+ * "table" matches entries reading that table in any database,
+ * "db.table" only those reading it in that database
+ */
+static int mysql2_cache_reads_table(mysql2_cache_entry *entry, const char *table) {
+  const char *cur = entry->tables, *end = entry->tables + entry->tablesLen;
+  int qualified = strchr(table, '.') != NULL;
+
+  while (cur < end) {
+    const char *name = cur;
+    if (!qualified) {
+      const char *dot = strrchr(cur, '.');
+      if (dot) {
+        name = dot + 1;
+      }
+    }
+    if (strcmp(name, table) == 0) {
+      return 1;
+    }
+    cur += strlen(cur) + 1;
+  }
+  return 0;
+}
+
+mysql2_cache_entry *mysql2_cache_lookup(const char *key) {
+  st_data_t val;
+  mysql2_cache_entry *entry;
+
+  if (!st_lookup(entries, (st_data_t)key, &val)) {
+    misses++;
+    return NULL;
+  }
+  entry = (mysql2_cache_entry *)val;
+  if (entry->expiresAt <= mysql2_cache_now()) {
+    mysql2_cache_remove(entry);
+    expirations++;
+    misses++;
+    return NULL;
+  }
+
+  mysql2_cache_unlink(entry);
+  mysql2_cache_push(entry);
+  entry->refs++;
+  hits++;
+  return entry;
+}
+
+/*
+ * Takes ownership of +result+ unless it's too big to ever fit the budget,
+ * in which case NULL is returned and the caller keeps it.
+ */
+mysql2_cache_entry *mysql2_cache_insert(const char *key, MYSQL_RES *result, size_t bytes, double ttl,
+                                        const char *sql, long sql_len) {
+  st_data_t val;
+  mysql2_cache_entry *entry;
+  size_t keyLen = strlen(key);
+
+  bytes += sizeof(mysql2_cache_entry) + keyLen + 1;
+  if (ttl <= 0 || bytes > budget) {
+    return NULL;
+  }
+
+  if (st_lookup(entries, (st_data_t)key, &val)) {
+    mysql2_cache_remove((mysql2_cache_entry *)val);
+  }
+  mysql2_cache_evict_to(budget - bytes);
+
+  entry = ALLOC(mysql2_cache_entry);
+  MEMZERO(entry, mysql2_cache_entry, 1);
+  entry->key = ALLOC_N(char, keyLen + 1);
+  memcpy(entry->key, key, keyLen + 1);
+  entry->result = result;
+  // stored results don't need their connection, and the entry outlives it
+  result->handle = NULL;
+  entry->bytes = bytes;
+  entry->expiresAt = mysql2_cache_now() + ttl;
+  entry->refs = 1;
+  entry->cached = 1;
+  mysql2_cache_collect_tables(entry, sql, sql_len);
+
+  st_insert(entries, (st_data_t)entry->key, (st_data_t)entry);
+  mysql2_cache_push(entry);
+  bytesUsed += bytes;
+  return entry;
+}
+
+void mysql2_cache_release(mysql2_cache_entry *entry) {
+  entry->refs--;
+  if (entry->refs == 0 && !entry->cached) {
+    mysql2_cache_free_entry(entry);
+  }
+}
+
+MYSQL_RES *mysql2_cache_result(mysql2_cache_entry *entry) {
+  return entry->result;
+}
+
+/* call-seq:
+ *    Mysql2::Client.result_cache_stats
+ *
+ * Returns counters for the result cache shared by every client in the process.
+ */
+static VALUE rb_mysql2_cache_stats(VALUE klass) {
+  VALUE stats = rb_hash_new();
+
+  rb_hash_aset(stats, sym_hits, ULONG2NUM(hits));
+  rb_hash_aset(stats, sym_misses, ULONG2NUM(misses));
+  rb_hash_aset(stats, sym_evictions, ULONG2NUM(evictions));
+  rb_hash_aset(stats, sym_expirations, ULONG2NUM(expirations));
+  rb_hash_aset(stats, sym_invalidations, ULONG2NUM(invalidations));
+  rb_hash_aset(stats, sym_entries, ULONG2NUM(entries->num_entries));
+  rb_hash_aset(stats, sym_bytes, SIZET2NUM(bytesUsed));
+  rb_hash_aset(stats, sym_budget, SIZET2NUM(budget));
+  return stats;
+}
+
+static VALUE rb_mysql2_cache_budget(VALUE klass) {
+  return SIZET2NUM(budget);
+}
+
+/* call-seq:
+ *    Mysql2::Client.result_cache_budget = bytes
+ *
+ * Sets how many bytes of results the cache may hold, evicting entries if
+ * it's holding more than that already.
+ */
+static VALUE rb_mysql2_cache_set_budget(VALUE klass, VALUE bytes) {
+  budget = NUM2SIZET(bytes);
+  mysql2_cache_evict_to(budget);
+  return bytes;
+}
+
+/* call-seq:
+ *    Mysql2::Client.invalidate_result_cache(table)
+ *
+ * Drops every cached result read from +table+, either a bare table name or
+ * "db.table". Returns how many were dropped.
+ */
+static VALUE rb_mysql2_cache_invalidate(VALUE klass, VALUE table) {
+  mysql2_cache_entry *entry, *older;
+  unsigned long count = 0;
+  const char *name;
+
+  table = rb_obj_as_string(table);
+  name = StringValueCStr(table);
+  for (entry = newest; entry; entry = older) {
+    older = entry->older;
+    if (mysql2_cache_reads_table(entry, name)) {
+      mysql2_cache_remove(entry);
+      count++;
+    }
+  }
+  invalidations += count;
+  return ULONG2NUM(count);
+}
+
+/* call-seq:
+ *    Mysql2::Client.clear_result_cache
+ *
+ * Drops every cached result.
+ */
+static VALUE rb_mysql2_cache_clear(VALUE klass) {
+  while (oldest) {
+    mysql2_cache_remove(oldest);
+    invalidations++;
+  }
+  return Qnil;
+}
+
+void init_mysql2_cache() {
+  entries = st_init_strtable();
+
+  rb_define_singleton_method(cMysql2Client, "result_cache_stats", rb_mysql2_cache_stats, 0);
+  rb_define_singleton_method(cMysql2Client, "result_cache_budget", rb_mysql2_cache_budget, 0);
+  rb_define_singleton_method(cMysql2Client, "result_cache_budget=", rb_mysql2_cache_set_budget, 1);
+  rb_define_singleton_method(cMysql2Client, "invalidate_result_cache", rb_mysql2_cache_invalidate, 1);
+  rb_define_singleton_method(cMysql2Client, "clear_result_cache", rb_mysql2_cache_clear, 0);
+
+  sym_hits          = ID2SYM(rb_intern("hits"));
+  sym_misses        = ID2SYM(rb_intern("misses"));
+  sym_evictions     = ID2SYM(rb_intern("evictions"));
+  sym_expirations   = ID2SYM(rb_intern("expirations"));
+  sym_invalidations = ID2SYM(rb_intern("invalidations"));
+  sym_entries       = ID2SYM(rb_intern("entries"));
+  sym_bytes         = ID2SYM(rb_intern("bytes"));
+  sym_budget        = ID2SYM(rb_intern("budget"));
+}
@@ -0,0 +1,15 @@
+#ifndef MYSQL2_CACHE_H
+#define MYSQL2_CACHE_H
+
+typedef struct mysql2_cache_entry mysql2_cache_entry;
+
+void init_mysql2_cache();
+
+/* both return an entry the caller holds a reference to, or NULL */
+mysql2_cache_entry *mysql2_cache_lookup(const char *key);
+mysql2_cache_entry *mysql2_cache_insert(const char *key, MYSQL_RES *result, size_t bytes, double ttl,
+                                        const char *sql, long sql_len);
+void mysql2_cache_release(mysql2_cache_entry *entry);
+MYSQL_RES *mysql2_cache_result(mysql2_cache_entry *entry);
+
+#endif
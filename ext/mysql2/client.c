@@ -4,25 +4,58 @@
 #ifndef _WIN32
 #include <sys/socket.h>
 #endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#include <sys/time.h>
+#endif
 #include "wait_for_single_fd.h"
 
 VALUE cMysql2Client;
 extern VALUE mMysql2, cMysql2Error;
 static VALUE intern_encoding_from_charset;
-static VALUE sym_id, sym_version, sym_async, sym_symbolize_keys, sym_as, sym_array, sym_stream;
-static ID intern_merge, intern_error_number_eql, intern_sql_state_eql;
+static VALUE sym_id, sym_version, sym_async, sym_symbolize_keys, sym_as, sym_array, sym_stream, sym_cache, sym_spill,
+             sym_timeout, sym_on_timeout, sym_cancel, sym_connect_time, sym_ssl_cipher, sym_ssl_session_reused;
+static ID intern_merge, intern_error_number_eql, intern_sql_state_eql, intern_cancel, intern_reconnect_after_fork;
+
+#ifdef HAVE_MYSQL_GET_SSL_SESSION_DATA
+/*
+ * TLS sessions from the last connection to each "user@host:port/socket",
+ * shared by every client in the process so new connections can resume them
+ * instead of doing a full handshake
+ */
+static VALUE ssl_session_cache;
+#endif
+
+#ifdef HAVE_FORK
+#define CLIENT_FORKED(wrapper) (wrapper->connect_pid && wrapper->connect_pid != getpid())
+#define REQUIRE_OWN_CONNECTION(wrapper) \
+  if (!wrapper->closed && CLIENT_FORKED(wrapper)) { \
+    reconnect_after_fork(self, wrapper); \
+  }
+#else
+#define CLIENT_FORKED(wrapper) 0
+#define REQUIRE_OWN_CONNECTION(wrapper)
+#endif
 
+// close frees the MYSQL handle, so :reconnect can't bring a closed client back
 #define REQUIRE_OPEN_DB(wrapper) \
-  if(!wrapper->reconnect_enabled && wrapper->closed) { \
+  if((!wrapper->reconnect_enabled && wrapper->closed) || wrapper->client == NULL) { \
     rb_raise(cMysql2Error, "closed MySQL connection"); \
-  }
+  } \
+  REQUIRE_OWN_CONNECTION(wrapper)
 
 #define MARK_CONN_INACTIVE(conn) \
   wrapper->active_thread = Qnil;
 
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+#define GET_CLIENT(self) \
+  mysql_client_wrapper *wrapper; \
+  TypedData_Get_Struct(self, mysql_client_wrapper, &rb_mysql_client_type, wrapper)
+#else
 #define GET_CLIENT(self) \
   mysql_client_wrapper *wrapper; \
   Data_Get_Struct(self, mysql_client_wrapper, wrapper)
+#endif
 
 /*
  * used to pass all arguments to mysql_real_connect while inside
@@ -85,12 +118,12 @@ struct nogvl_select_db_args {
 static void rb_mysql_client_mark(void * wrapper) {
   mysql_client_wrapper * w = wrapper;
   if (w) {
-    rb_gc_mark(w->encoding);
-    rb_gc_mark(w->active_thread);
+    rb_gc_mark_movable(w->encoding);
+    rb_gc_mark_movable(w->active_thread);
   }
 }
 
-static VALUE rb_raise_mysql2_error(mysql_client_wrapper *wrapper) {
+VALUE rb_raise_mysql2_error(mysql_client_wrapper *wrapper) {
   VALUE rb_error_msg = rb_str_new2(mysql_error(wrapper->client));
   VALUE rb_sql_state = rb_tainted_str_new2(mysql_sqlstate(wrapper->client));
 #ifdef HAVE_RUBY_ENCODING_H
@@ -112,6 +145,27 @@ static VALUE rb_raise_mysql2_error(mysql_client_wrapper *wrapper) {
   return Qnil;
 }
 
+/*
+ * RUBY_UBF_IO only interrupts the syscall libmysql is blocked in, which it
+ * then retries, so Thread#kill or Timeout would wait for the server (or
+ * TCP) to give up. Shutting the socket down makes that read or write fail
+ * right away instead, at the price of the connection. Ruby calls this for
+ * every interrupt though, a trapped signal or Thread#wakeup too, so it's
+ * only used with :shutdown_on_interrupt => true, see MYSQL2_CLIENT_UBF.
+ *
+ * net.vio is only set once the server was reached, before that net.fd may
+ * be 0 or a descriptor left over from a previous connection.
+ */
+void rb_mysql_client_unblock(void *ptr) {
+#ifndef _WIN32
+  MYSQL *client = ptr;
+
+  if (client && client->net.vio && client->net.fd > 0) {
+    shutdown(client->net.fd, 2);
+  }
+#endif
+}
+
 static VALUE nogvl_init(void *ptr) {
   MYSQL *client;
 
@@ -132,6 +186,26 @@ static VALUE nogvl_connect(void *ptr) {
   return client ? Qtrue : Qfalse;
 }
 
+#ifdef HAVE_FORK
+/*
+ * A child process shares the socket of a connection its parent made, and
+ * the QUIT that mysql_close sends (or a shutdown()) would end the parent's
+ * session. Pointing the fd at a fresh, unconnected socket lets mysql_close
+ * do its cleanup without touching the connection; the parent's copy of the
+ * fd is unaffected.
+ */
+static void invalidate_fd(int clientfd) {
+  int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (sockfd < 0) {
+    close(clientfd);
+    return;
+  }
+  dup2(sockfd, clientfd);
+  close(sockfd);
+}
+#endif
+
 static VALUE nogvl_close(void *ptr) {
   mysql_client_wrapper *wrapper;
 #ifndef _WIN32
@@ -141,6 +215,17 @@ static VALUE nogvl_close(void *ptr) {
   if (!wrapper->closed) {
     wrapper->closed = 1;
     wrapper->active_thread = Qnil;
+#ifdef HAVE_FORK
+    if (CLIENT_FORKED(wrapper)) {
+      if (wrapper->client->net.vio) {
+        invalidate_fd(wrapper->client->net.fd);
+      }
+      mysql_close(wrapper->client);
+      xfree(wrapper->client);
+      wrapper->client = NULL;
+      return Qnil;
+    }
+#endif
     /*
      * we'll send a QUIT message to the server, but that message is more of a
      * formality than a hard requirement since the socket is getting shutdown
@@ -158,6 +243,7 @@ static VALUE nogvl_close(void *ptr) {
 
     mysql_close(wrapper->client);
     xfree(wrapper->client);
+    wrapper->client = NULL;
   }
 
   return Qnil;
@@ -171,18 +257,105 @@ static void rb_mysql_client_free(void * ptr) {
   xfree(ptr);
 }
 
+/*
+ * Let go of the current connection, whatever state it's in, and leave a
+ * fresh MYSQL handle for init_connection and connect to set up again.
+ */
+static void reset_client(mysql_client_wrapper *wrapper) {
+  if (!wrapper->closed) {
+    nogvl_close(wrapper);
+  } else if (wrapper->client && wrapper->client->net.vio) {
+    // disconnect_and_raise already shut the socket down, this only frees
+    mysql_close(wrapper->client);
+    xfree(wrapper->client);
+    wrapper->client = NULL;
+  }
+
+  if (!wrapper->client) {
+    wrapper->client = ALLOC(MYSQL);
+    MEMZERO(wrapper->client, MYSQL, 1);
+  }
+  wrapper->connect_pid = 0;
+}
+
+#ifdef HAVE_FORK
+/*
+ * First use of a client in a process forked after it connected: let go
+ * of the parent's connection and open our own with the same options.
+ */
+static void reconnect_after_fork(VALUE self, mysql_client_wrapper *wrapper) {
+  reset_client(wrapper);
+  rb_funcall(self, intern_reconnect_after_fork, 0);
+}
+#endif
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+/* the MYSQL handle and its network buffer, which libmysql sizes to max_packet */
+static size_t rb_mysql_client_memsize(const void * ptr) {
+  const mysql_client_wrapper * wrapper = ptr;
+  size_t size = sizeof(mysql_client_wrapper);
+
+  if (!wrapper->closed) {
+    size += sizeof(MYSQL) + wrapper->client->net.max_packet;
+  }
+  return size;
+}
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+static void rb_mysql_client_compact(void * ptr) {
+  mysql_client_wrapper * wrapper = ptr;
+
+  mysql2_gc_location(wrapper->encoding);
+  mysql2_gc_location(wrapper->active_thread);
+}
+#endif
+
+const rb_data_type_t rb_mysql_client_type = {
+  "rb_mysql_client",
+  {
+    rb_mysql_client_mark,
+    rb_mysql_client_free,
+    rb_mysql_client_memsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    rb_mysql_client_compact,
+#endif
+  },
+  0,
+  0,
+#ifdef RUBY_TYPED_WB_PROTECTED
+  RUBY_TYPED_WB_PROTECTED,
+#endif
+};
+#endif
+
 static VALUE allocate(VALUE klass) {
   VALUE obj;
   mysql_client_wrapper * wrapper;
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+  obj = TypedData_Make_Struct(klass, mysql_client_wrapper, &rb_mysql_client_type, wrapper);
+#else
   obj = Data_Make_Struct(klass, mysql_client_wrapper, rb_mysql_client_mark, rb_mysql_client_free, wrapper);
+#endif
   wrapper->encoding = Qnil;
   wrapper->active_thread = Qnil;
   wrapper->reconnect_enabled = 0;
   wrapper->closed = 1;
-  wrapper->client = (MYSQL*)xmalloc(sizeof(MYSQL));
+  wrapper->shutdown_on_interrupt = 0;
+  wrapper->connect_pid = 0;
+  wrapper->client = ALLOC(MYSQL);
+  MEMZERO(wrapper->client, MYSQL, 1);
   return obj;
 }
 
+/*
+ * Frees what libmysql keeps for the calling thread, which mysql_init set up.
+ * Only for threads that are about to end, see Client.connect_many.
+ */
+static VALUE rb_mysql_client_thread_end(RB_MYSQL_UNUSED VALUE klass) {
+  mysql_thread_end();
+  return Qnil;
+}
+
 static VALUE rb_mysql_client_escape(RB_MYSQL_UNUSED VALUE klass, VALUE str) {
   unsigned char *newStr;
   VALUE rb_str;
@@ -208,9 +381,46 @@ static VALUE rb_mysql_client_escape(RB_MYSQL_UNUSED VALUE klass, VALUE str) {
   }
 }
 
+#ifdef HAVE_MYSQL_GET_SSL_SESSION_DATA
+/*
+ * TLS sessions are only offered again to the same account on the same
+ * server with the same TLS settings, one set up after checking another CA
+ * or with another client certificate must not be resumed
+ */
+static VALUE ssl_session_key(mysql_client_wrapper *wrapper, struct nogvl_connect_args *args) {
+  static const enum mysql_option options[] = {
+    MYSQL_OPT_SSL_KEY, MYSQL_OPT_SSL_CERT, MYSQL_OPT_SSL_CA, MYSQL_OPT_SSL_CAPATH,
+    MYSQL_OPT_SSL_CIPHER, MYSQL_OPT_TLS_VERSION, MYSQL_OPT_TLS_CIPHERSUITES
+  };
+  VALUE key;
+  const char *value;
+  unsigned int mode = 0, i;
+
+  key = rb_sprintf("%s@%s:%u/%s", args->user ? args->user : "", args->host, args->port,
+                   args->unix_socket ? args->unix_socket : "");
+  for (i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+    value = NULL;
+    mysql_get_option(wrapper->client, options[i], &value);
+    // NUL can't be part of a path or a cipher name
+    rb_str_cat(key, "", 1);
+    if (value) {
+      rb_str_cat2(key, value);
+    }
+  }
+  mysql_get_option(wrapper->client, MYSQL_OPT_SSL_MODE, &mode);
+  rb_str_cat(key, "", 1);
+  rb_str_catf(key, "%u", mode);
+  return key;
+}
+#endif
+
 static VALUE rb_connect(VALUE self, VALUE user, VALUE pass, VALUE host, VALUE port, VALUE database, VALUE socket, VALUE flags) {
   struct nogvl_connect_args args;
   VALUE rv;
+#ifdef HAVE_MYSQL_GET_SSL_SESSION_DATA
+  VALUE session_key, session;
+  void *session_data;
+#endif
   GET_CLIENT(self);
 
   args.host = NIL_P(host) ? "localhost" : StringValuePtr(host);
@@ -222,15 +432,38 @@ static VALUE rb_connect(VALUE self, VALUE user, VALUE pass, VALUE host, VALUE po
   args.mysql = wrapper->client;
   args.client_flag = NUM2ULONG(flags);
 
-  rv = rb_thread_blocking_region(nogvl_connect, &args, RUBY_UBF_IO, 0);
+#ifdef HAVE_MYSQL_GET_SSL_SESSION_DATA
+  session_key = ssl_session_key(wrapper, &args);
+  session = rb_hash_aref(ssl_session_cache, session_key);
+  if (!NIL_P(session)) {
+    // libmysql falls back to a full handshake if the session can't be resumed
+    mysql_options(wrapper->client, MYSQL_OPT_SSL_SESSION_DATA, StringValueCStr(session));
+  }
+#endif
+
+  rv = rb_thread_blocking_region(nogvl_connect, &args, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
   if (rv == Qfalse) {
     while (rv == Qfalse && errno == EINTR && !mysql_errno(wrapper->client)) {
       errno = 0;
-      rv = rb_thread_blocking_region(nogvl_connect, &args, RUBY_UBF_IO, 0);
+      rv = rb_thread_blocking_region(nogvl_connect, &args, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
     }
     if (rv == Qfalse)
       return rb_raise_mysql2_error(wrapper);
   }
+#ifdef HAVE_FORK
+  wrapper->connect_pid = getpid();
+#endif
+
+#ifdef HAVE_MYSQL_GET_SSL_SESSION_DATA
+  if (mysql_get_ssl_cipher(wrapper->client)) {
+    session_data = mysql_get_ssl_session_data(wrapper->client, 0, NULL);
+    if (session_data) {
+      rb_hash_aset(ssl_session_cache, session_key, rb_str_new2(session_data));
+      mysql_free_ssl_session_data(wrapper->client, session_data);
+    }
+  }
+  RB_GC_GUARD(session);
+#endif
 
   return self;
 }
@@ -268,7 +501,7 @@ static VALUE nogvl_send_query(void *ptr) {
 static VALUE do_send_query(void *args) {
   struct nogvl_send_query_args *query_args = args;
   mysql_client_wrapper *wrapper = query_args->wrapper;
-  if (rb_thread_blocking_region(nogvl_send_query, args, RUBY_UBF_IO, 0) == Qfalse) {
+  if (rb_thread_blocking_region(nogvl_send_query, args, MYSQL2_CLIENT_UBF(wrapper), wrapper->client) == Qfalse) {
     // an error occurred, we're not active anymore
     MARK_CONN_INACTIVE(self);
     return rb_raise_mysql2_error(wrapper);
@@ -322,7 +555,7 @@ static VALUE nogvl_use_result(void *ptr) {
  */
 static VALUE rb_mysql_client_async_result(VALUE self) {
   MYSQL_RES * result;
-  VALUE resultObj;
+  VALUE resultObj, opts, spillOpt = Qnil;
 #ifdef HAVE_RUBY_ENCODING_H
   mysql2_result_wrapper * result_wrapper;
 #endif
@@ -333,17 +566,23 @@ static VALUE rb_mysql_client_async_result(VALUE self) {
     return Qnil;
 
   REQUIRE_OPEN_DB(wrapper);
-  if (rb_thread_blocking_region(nogvl_read_query_result, wrapper->client, RUBY_UBF_IO, 0) == Qfalse) {
+  if (rb_thread_blocking_region(nogvl_read_query_result, wrapper->client, MYSQL2_CLIENT_UBF(wrapper), wrapper->client) == Qfalse) {
     // an error occurred, mark this connection inactive
     MARK_CONN_INACTIVE(self);
     return rb_raise_mysql2_error(wrapper);
   }
 
-  VALUE is_streaming = rb_hash_aref(rb_iv_get(self, "@query_options"), sym_stream);
-  if(is_streaming == Qtrue) {
-    result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_use_result, wrapper, RUBY_UBF_IO, 0);
+  opts = rb_iv_get(self, "@query_options");
+  VALUE is_streaming = rb_hash_aref(opts, sym_stream);
+#ifdef HAVE_SYS_MMAN_H
+  if (is_streaming != Qtrue) {
+    spillOpt = rb_iv_get(self, "@spill");
+  }
+#endif
+  if(is_streaming == Qtrue || RTEST(spillOpt)) {
+    result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_use_result, wrapper, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
   } else {
-    result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_store_result, wrapper, RUBY_UBF_IO, 0);
+    result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_store_result, wrapper, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
   }
 
   if (result == NULL) {
@@ -355,13 +594,21 @@ static VALUE rb_mysql_client_async_result(VALUE self) {
     return Qnil;
   }
 
-  resultObj = rb_mysql_result_to_obj(result);
+  // streamed rows are still read off this connection, interrupting that goes through it
+  resultObj = rb_mysql_result_to_obj(result, (is_streaming == Qtrue || RTEST(spillOpt)) ? self : Qnil);
   // pass-through query options for result construction later
-  rb_iv_set(resultObj, "@query_options", rb_funcall(rb_iv_get(self, "@query_options"), rb_intern("dup"), 0));
+  rb_iv_set(resultObj, "@query_options", rb_funcall(opts, rb_intern("dup"), 0));
 
 #ifdef HAVE_RUBY_ENCODING_H
   GetMysql2Result(resultObj, result_wrapper);
-  result_wrapper->encoding = wrapper->encoding;
+  RB_OBJ_WRITE(resultObj, &result_wrapper->encoding, wrapper->encoding);
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+  if (RTEST(spillOpt)) {
+    // :spill => "/some/dir" puts the file there, true in $TMPDIR
+    rb_mysql_result_spill(resultObj, spillOpt == Qtrue ? Qnil : spillOpt);
+  }
 #endif
   return resultObj;
 }
@@ -370,6 +617,9 @@ static VALUE rb_mysql_client_async_result(VALUE self) {
 struct async_query_args {
   int fd;
   VALUE self;
+  VALUE timeout;         /* seconds, or nil to wait forever */
+  int cancel_on_timeout; /* :on_timeout => :cancel */
+  int timed_out;
 };
 
 static VALUE disconnect_and_raise(VALUE self, VALUE error) {
@@ -387,37 +637,91 @@ static VALUE disconnect_and_raise(VALUE self, VALUE error) {
   return Qnil;
 }
 
+/*
+ * the query timed out and we were asked to cancel it rather than drop the
+ * connection: KILL QUERY it over a side connection, then read off and
+ * throw away whatever the server sends back. Returns Qtrue if that left
+ * the connection usable.
+ */
+static VALUE nogvl_drain_results(void *ptr) {
+  MYSQL *client = ptr;
+  MYSQL_RES *result;
+
+  if (mysql_read_query_result(client) == 0) {
+    do {
+      result = mysql_store_result(client);
+      if (result) {
+        mysql_free_result(result);
+      }
+    } while (mysql_next_result(client) == 0);
+  }
+
+  // server errors, like the query having been interrupted, are harmless
+  return mysql_errno(client) < CR_MIN_ERROR ? Qtrue : Qfalse;
+}
+
+static VALUE cancel_and_drain(VALUE args) {
+  struct async_query_args *async_args = (struct async_query_args *)args;
+  struct timeval tv;
+  double sec;
+  GET_CLIENT(async_args->self);
+
+  rb_funcall(async_args->self, intern_cancel, 0);
+
+  // a killed query is answered right away, a server that doesn't within
+  // another timeout isn't going to and the connection is dropped after all
+  sec = NUM2DBL(async_args->timeout);
+  tv.tv_sec = (long)sec;
+  tv.tv_usec = (long)((sec - tv.tv_sec) * 1000000);
+  if (rb_wait_for_single_fd(async_args->fd, RB_WAITFD_IN, &tv) <= 0) {
+    return Qfalse;
+  }
+  return rb_thread_blocking_region(nogvl_drain_results, wrapper->client, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
+}
+
+static VALUE handle_query_error(VALUE args, VALUE error) {
+  struct async_query_args *async_args = (struct async_query_args *)args;
+
+  if (async_args->timed_out && async_args->cancel_on_timeout) {
+    int state = 0;
+
+    if (rb_protect(cancel_and_drain, args, &state) == Qtrue && state == 0) {
+      GET_CLIENT(async_args->self);
+      wrapper->active_thread = Qnil;
+      rb_exc_raise(error);
+    }
+  }
+
+  return disconnect_and_raise(async_args->self, error);
+}
+
 static VALUE do_query(void *args) {
   struct async_query_args *async_args;
   struct timeval tv;
   struct timeval* tvp;
-  long int sec;
+  double sec = 0;
   int retval;
-  VALUE read_timeout;
 
   async_args = (struct async_query_args *)args;
-  read_timeout = rb_iv_get(async_args->self, "@read_timeout");
 
   tvp = NULL;
-  if (!NIL_P(read_timeout)) {
-    Check_Type(read_timeout, T_FIXNUM);
-    tvp = &tv;
-    sec = FIX2INT(read_timeout);
-    // TODO: support partial seconds?
-    // also, this check is here for sanity, we also check up in Ruby
-    if (sec >= 0) {
-      tvp->tv_sec = sec;
-    } else {
-      rb_raise(cMysql2Error, "read_timeout must be a positive integer, you passed %ld", sec);
+  if (!NIL_P(async_args->timeout)) {
+    sec = NUM2DBL(async_args->timeout);
+    // this check is here for sanity, we also check up in Ruby
+    if (sec < 0) {
+      rb_raise(cMysql2Error, "read_timeout must be a positive number, you passed %g", sec);
     }
-    tvp->tv_usec = 0;
+    tvp = &tv;
+    tvp->tv_sec = (long)sec;
+    tvp->tv_usec = (long)((sec - tvp->tv_sec) * 1000000);
   }
 
   for(;;) {
     retval = rb_wait_for_single_fd(async_args->fd, RB_WAITFD_IN, tvp);
 
     if (retval == 0) {
-      rb_raise(cMysql2Error, "Timeout waiting for a response from the last query. (waited %d seconds)", FIX2INT(read_timeout));
+      async_args->timed_out = 1;
+      rb_raise(cMysql2Error, "Timeout waiting for a response from the last query. (waited %g seconds)", sec);
     }
 
     if (retval < 0) {
@@ -444,7 +748,7 @@ static VALUE finish_and_mark_inactive(void *args) {
     // if we got here, the result hasn't been read off the wire yet
     // so lets do that and then throw it away because we have no way
     // of getting it back up to the caller from here
-    result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_store_result, wrapper, RUBY_UBF_IO, 0);
+    result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_store_result, wrapper, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
     mysql_free_result(result);
 
     wrapper->active_thread = Qnil;
@@ -460,13 +764,47 @@ static VALUE finish_and_mark_inactive(void *args) {
  * Query the database with +sql+, with optional +options+.  For the possible
  * options, see @@default_query_options on the Mysql2::Client class.
  */
+/*
+ * Results are cached per server, account, database and connection charset.
+ * A connection that has session state of its own (see @cache_scope in
+ * client.rb) only shares results with itself. Returns nil for SQL the
+ * cache can't key, i.e. with a NUL byte in it.
+ */
+static VALUE rb_mysql_client_cache_key(VALUE self, mysql_client_wrapper * wrapper, VALUE sql) {
+  MYSQL *client = wrapper->client;
+  char port[16];
+  VALUE key, scope;
+
+  if (memchr(RSTRING_PTR(sql), '\0', RSTRING_LEN(sql))) {
+    return Qnil;
+  }
+
+  snprintf(port, sizeof(port), ":%u/", client->port);
+  key = rb_str_new2(client->user ? client->user : "");
+  rb_str_cat2(key, "@");
+  rb_str_cat2(key, client->host ? client->host : "");
+  rb_str_cat2(key, port);
+  rb_str_cat2(key, client->db ? client->db : "");
+  rb_str_cat2(key, "/");
+  rb_str_cat2(key, mysql_character_set_name(client));
+  scope = rb_iv_get(self, "@cache_scope");
+  if (!NIL_P(scope)) {
+    rb_str_cat2(key, "#");
+    rb_str_append(key, rb_obj_as_string(scope));
+  }
+  rb_str_cat2(key, "\n");
+  rb_str_cat(key, RSTRING_PTR(sql), RSTRING_LEN(sql));
+  return key;
+}
+
 static VALUE rb_mysql_client_query(int argc, VALUE * argv, VALUE self) {
 #ifndef _WIN32
   struct async_query_args async_args;
 #endif
   struct nogvl_send_query_args args;
   int async = 0;
-  VALUE opts, defaults;
+  VALUE opts, defaults, resultObj, callOpts = Qnil;
+  VALUE cacheTtl = Qnil, cacheKey = Qnil, persisted;
   VALUE thread_current = rb_thread_current();
 #ifdef HAVE_RUBY_ENCODING_H
   rb_encoding *conn_enc;
@@ -478,9 +816,14 @@ static VALUE rb_mysql_client_query(int argc, VALUE * argv, VALUE self) {
 
 
   defaults = rb_iv_get(self, "@query_options");
-  if (rb_scan_args(argc, argv, "11", &args.sql, &opts) == 2) {
-    opts = rb_funcall(defaults, intern_merge, 1, opts);
-    rb_iv_set(self, "@query_options", opts);
+  if (rb_scan_args(argc, argv, "11", &args.sql, &callOpts) == 2) {
+    opts = rb_funcall(defaults, intern_merge, 1, callOpts);
+    // the rest become the client's defaults, :cache and :spill only apply to this query
+    persisted = rb_funcall(opts, rb_intern("dup"), 0);
+    rb_hash_delete(persisted, sym_cache);
+    rb_hash_delete(persisted, sym_spill);
+    rb_iv_set(self, "@query_options", persisted);
+    cacheTtl = rb_hash_aref(callOpts, sym_cache);
 
     if (rb_hash_aref(opts, sym_async) == Qtrue) {
       async = 1;
@@ -498,10 +841,31 @@ static VALUE rb_mysql_client_query(int argc, VALUE * argv, VALUE self) {
   args.sql_ptr = StringValuePtr(args.sql);
   args.sql_len = RSTRING_LEN(args.sql);
 
+  // async and streamed results never go through the cache, nor does anything
+  // inside a transaction, which may see its own uncommitted writes
+  if (RTEST(cacheTtl) && !async && rb_hash_aref(opts, sym_stream) != Qtrue && NIL_P(wrapper->active_thread) &&
+      !(wrapper->client->server_status & SERVER_STATUS_IN_TRANS)) {
+    cacheKey = rb_mysql_client_cache_key(self, wrapper, args.sql);
+  }
+  if (!NIL_P(cacheKey)) {
+    resultObj = rb_mysql_result_from_cache(cacheKey);
+    if (!NIL_P(resultObj)) {
+#ifdef HAVE_RUBY_ENCODING_H
+      mysql2_result_wrapper * result_wrapper;
+#endif
+      rb_iv_set(resultObj, "@query_options", rb_funcall(opts, rb_intern("dup"), 0));
+#ifdef HAVE_RUBY_ENCODING_H
+      GetMysql2Result(resultObj, result_wrapper);
+      RB_OBJ_WRITE(resultObj, &result_wrapper->encoding, wrapper->encoding);
+#endif
+      return resultObj;
+    }
+  }
+
   // see if this connection is still waiting on a result from a previous query
   if (NIL_P(wrapper->active_thread)) {
     // mark this connection active
-    wrapper->active_thread = thread_current;
+    RB_OBJ_WRITE(self, &wrapper->active_thread, thread_current);
   } else if (wrapper->active_thread == thread_current) {
     rb_raise(cMysql2Error, "This connection is still waiting for a result, try again once you have the result");
   } else {
@@ -513,6 +877,8 @@ static VALUE rb_mysql_client_query(int argc, VALUE * argv, VALUE self) {
   }
 
   args.wrapper = wrapper;
+  // read by async_result, which may run much later for an :async query
+  rb_iv_set(self, "@spill", NIL_P(callOpts) ? Qnil : rb_hash_aref(callOpts, sym_spill));
 
 #ifndef _WIN32
   rb_rescue2(do_send_query, (VALUE)&args, disconnect_and_raise, self, rb_eException, (VALUE)0);
@@ -520,10 +886,20 @@ static VALUE rb_mysql_client_query(int argc, VALUE * argv, VALUE self) {
   if (!async) {
     async_args.fd = wrapper->client->net.fd;
     async_args.self = self;
+    async_args.timeout = rb_hash_aref(opts, sym_timeout);
+    if (NIL_P(async_args.timeout)) {
+      async_args.timeout = rb_iv_get(self, "@read_timeout");
+    }
+    async_args.cancel_on_timeout = rb_hash_aref(opts, sym_on_timeout) == sym_cancel;
+    async_args.timed_out = 0;
 
-    rb_rescue2(do_query, (VALUE)&async_args, disconnect_and_raise, self, rb_eException, (VALUE)0);
+    rb_rescue2(do_query, (VALUE)&async_args, handle_query_error, (VALUE)&async_args, rb_eException, (VALUE)0);
 
-    return rb_mysql_client_async_result(self);
+    resultObj = rb_mysql_client_async_result(self);
+    if (!NIL_P(cacheKey) && !NIL_P(resultObj)) {
+      rb_mysql_result_store_in_cache(resultObj, cacheKey, NUM2DBL(cacheTtl), args.sql);
+    }
+    return resultObj;
   } else {
     return Qnil;
   }
@@ -531,7 +907,11 @@ static VALUE rb_mysql_client_query(int argc, VALUE * argv, VALUE self) {
   do_send_query(&args);
 
   // this will just block until the result is ready
-  return rb_ensure(rb_mysql_client_async_result, self, finish_and_mark_inactive, self);
+  resultObj = rb_ensure(rb_mysql_client_async_result, self, finish_and_mark_inactive, self);
+  if (!NIL_P(cacheKey) && !NIL_P(resultObj)) {
+    rb_mysql_result_store_in_cache(resultObj, cacheKey, NUM2DBL(cacheTtl), args.sql);
+  }
+  return resultObj;
 #endif
 }
 
@@ -608,6 +988,17 @@ static VALUE rb_mysql_client_info(VALUE self) {
   }
 #endif
   rb_hash_aset(version, sym_version, client_info);
+
+  if (!wrapper->closed) {
+    const char *cipher = mysql_get_ssl_cipher(wrapper->client);
+
+    // seconds spent in mysql_real_connect: TCP, TLS and auth
+    rb_hash_aset(version, sym_connect_time, rb_iv_get(self, "@connect_time"));
+    rb_hash_aset(version, sym_ssl_cipher, cipher ? rb_str_new2(cipher) : Qnil);
+#ifdef HAVE_MYSQL_GET_SSL_SESSION_DATA
+    rb_hash_aset(version, sym_ssl_session_reused, mysql_get_ssl_session_reused(wrapper->client) ? Qtrue : Qfalse);
+#endif
+  }
   return version;
 }
 
@@ -659,6 +1050,188 @@ static VALUE rb_mysql_client_socket(VALUE self) {
 #endif
 }
 
+#ifdef HAVE_POLL_H
+/*
+ * used to pass all arguments to poll while inside
+ * rb_thread_blocking_region
+ *
+ * fds that have become readable are flipped negative, which also makes
+ * poll skip them on the next round
+ */
+struct nogvl_poll_args {
+  struct pollfd *fds;
+  unsigned long nfds;
+  int all;
+  int has_deadline;
+  struct timeval deadline;
+  int error;
+};
+
+static int mysql2_ms_until(const struct timeval *deadline) {
+  struct timeval now;
+  long ms;
+
+  gettimeofday(&now, NULL);
+  ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_usec - now.tv_usec) / 1000;
+  return ms > 0 ? (int)ms : 0;
+}
+
+static VALUE nogvl_poll(void *ptr) {
+  struct nogvl_poll_args *args = ptr;
+  unsigned long i, pending;
+  int retval;
+
+  for (;;) {
+    retval = poll(args->fds, args->nfds, args->has_deadline ? mysql2_ms_until(&args->deadline) : -1);
+    if (retval < 0) {
+      // EINTR included, that's how Thread#raise and friends get us back
+      args->error = errno;
+      return Qfalse;
+    }
+    if (retval == 0) {
+      // timed out
+      return Qtrue;
+    }
+
+    pending = 0;
+    for (i = 0; i < args->nfds; i++) {
+      if (args->fds[i].fd < 0) {
+        continue;
+      }
+      if (args->fds[i].revents) {
+        args->fds[i].fd = -args->fds[i].fd - 1;
+      } else {
+        pending++;
+      }
+    }
+
+    if (!args->all || pending == 0) {
+      return Qtrue;
+    }
+  }
+}
+
+/*
+ * the pollfd array is sized by the caller's Array, so it lives on the heap
+ * and is freed by rb_mysql_client_wait_free whatever gets raised
+ */
+struct mysql2_wait_args {
+  struct nogvl_poll_args poll;
+  VALUE clients;
+};
+
+static VALUE rb_mysql_client_wait_free(VALUE ptr) {
+  struct mysql2_wait_args *wait = (struct mysql2_wait_args *)ptr;
+
+  xfree(wait->poll.fds);
+  return Qnil;
+}
+
+static VALUE rb_mysql_client_wait_fds(VALUE ptr) {
+  struct mysql2_wait_args *wait = (struct mysql2_wait_args *)ptr;
+  struct nogvl_poll_args *args = &wait->poll;
+  VALUE ready;
+  unsigned long i, pending = 0;
+
+  for (i = 0; i < args->nfds; i++) {
+    VALUE client = rb_ary_entry(wait->clients, i);
+    GET_CLIENT(client);
+
+    args->fds[i].events = POLLIN;
+    args->fds[i].revents = 0;
+    // a client that isn't waiting on a query has nothing to wait for
+    if (NIL_P(wrapper->active_thread) || wrapper->closed || wrapper->client == NULL) {
+      args->fds[i].fd = -1;
+    } else {
+      args->fds[i].fd = wrapper->client->net.fd;
+      pending++;
+    }
+  }
+
+  // only block if there is something left to wait for
+  if (pending > 0 && (args->all || pending == args->nfds)) {
+    while (rb_thread_blocking_region(nogvl_poll, args, RUBY_UBF_IO, 0) == Qfalse) {
+      if (args->error != EINTR) {
+        errno = args->error;
+        rb_sys_fail(0);
+      }
+      args->error = 0;
+    }
+  }
+
+  ready = rb_ary_new();
+  for (i = 0; i < args->nfds; i++) {
+    if (args->fds[i].fd < 0) {
+      rb_ary_push(ready, rb_ary_entry(wait->clients, i));
+    }
+  }
+  return ready;
+}
+
+static VALUE rb_mysql_client_wait(int argc, VALUE * argv, int all) {
+  struct mysql2_wait_args wait;
+  struct nogvl_poll_args *args = &wait.poll;
+  VALUE clients, timeout;
+
+  rb_scan_args(argc, argv, "11", &clients, &timeout);
+  Check_Type(clients, T_ARRAY);
+
+  args->all = all;
+  args->has_deadline = 0;
+  args->error = 0;
+
+  if (!NIL_P(timeout)) {
+    double sec = NUM2DBL(timeout);
+    if (sec < 0) {
+      rb_raise(rb_eArgError, "timeout must be a positive number, you passed %f", sec);
+    }
+    gettimeofday(&args->deadline, NULL);
+    args->deadline.tv_sec += (time_t)sec;
+    args->deadline.tv_usec += (suseconds_t)((sec - (time_t)sec) * 1000000);
+    if (args->deadline.tv_usec >= 1000000) {
+      args->deadline.tv_sec++;
+      args->deadline.tv_usec -= 1000000;
+    }
+    args->has_deadline = 1;
+  }
+
+  wait.clients = clients;
+  args->nfds = RARRAY_LEN(clients);
+  args->fds = ALLOC_N(struct pollfd, args->nfds);
+  return rb_ensure(rb_mysql_client_wait_fds, (VALUE)&wait, rb_mysql_client_wait_free, (VALUE)&wait);
+}
+#endif
+
+/* call-seq:
+ *    Mysql2::Client.wait_any(clients, timeout = nil)
+ *
+ * Wait until at least one of +clients+ has the result of its +:async+ query
+ * ready to be read with #async_result, or +timeout+ seconds have passed.
+ * Returns the clients that are ready, an empty Array if the timeout expired
+ * first. Clients that aren't waiting on a query count as ready.
+ */
+static VALUE rb_mysql_client_wait_any(int argc, VALUE * argv, RB_MYSQL_UNUSED VALUE klass) {
+#ifdef HAVE_POLL_H
+  return rb_mysql_client_wait(argc, argv, 0);
+#else
+  rb_raise(cMysql2Error, "Waiting on several clients requires poll(2), which isn't available on this platform");
+#endif
+}
+
+/* call-seq:
+ *    Mysql2::Client.wait_all(clients, timeout = nil)
+ *
+ * Like wait_any, but waits until every one of +clients+ is ready or the
+ * timeout expires. Returns the clients that are ready.
+ */
+static VALUE rb_mysql_client_wait_all(int argc, VALUE * argv, RB_MYSQL_UNUSED VALUE klass) {
+#ifdef HAVE_POLL_H
+  return rb_mysql_client_wait(argc, argv, 1);
+#else
+  rb_raise(cMysql2Error, "Waiting on several clients requires poll(2), which isn't available on this platform");
+#endif
+}
+
 /* call-seq:
  *    client.last_id
  *
@@ -728,7 +1301,7 @@ static VALUE rb_mysql_client_select_db(VALUE self, VALUE db)
   args.mysql = wrapper->client;
   args.db = StringValuePtr(db);
 
-  if (rb_thread_blocking_region(nogvl_select_db, &args, RUBY_UBF_IO, 0) == Qfalse)
+  if (rb_thread_blocking_region(nogvl_select_db, &args, MYSQL2_CLIENT_UBF(wrapper), wrapper->client) == Qfalse)
     rb_raise_mysql2_error(wrapper); 
 
   return db;
@@ -754,13 +1327,15 @@ static VALUE rb_mysql_client_ping(VALUE self) {
   if (wrapper->closed) {
     return Qfalse;
   } else {
-    return rb_thread_blocking_region(nogvl_ping, wrapper->client, RUBY_UBF_IO, 0);
+    REQUIRE_OWN_CONNECTION(wrapper);
+    return rb_thread_blocking_region(nogvl_ping, wrapper->client, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
   }
 }
 
 static VALUE rb_mysql_client_more_results(VALUE self)
 {
   GET_CLIENT(self);
+  REQUIRE_OPEN_DB(wrapper);
     if (mysql_more_results(wrapper->client) == 0)
       return Qfalse;
     else
@@ -771,6 +1346,7 @@ static VALUE rb_mysql_client_next_result(VALUE self)
 {
     GET_CLIENT(self);
     int ret;
+    REQUIRE_OPEN_DB(wrapper);
     ret = mysql_next_result(wrapper->client);
     if (ret == 0)
       return Qtrue;
@@ -789,12 +1365,13 @@ static VALUE rb_mysql_client_store_result(VALUE self)
   
   
   GET_CLIENT(self);
+  REQUIRE_OPEN_DB(wrapper);
   // MYSQL_RES* res = mysql_store_result(wrapper->client);
   // if (res == NULL)
   //    mysql_raise(wrapper->client);
   // return mysqlres2obj(res);
   
-  result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_store_result, wrapper, RUBY_UBF_IO, 0);
+  result = (MYSQL_RES *)rb_thread_blocking_region(nogvl_store_result, wrapper, MYSQL2_CLIENT_UBF(wrapper), wrapper->client);
 
   if (result == NULL) {
     if (mysql_errno(wrapper->client) != 0) {
@@ -804,13 +1381,13 @@ static VALUE rb_mysql_client_store_result(VALUE self)
     return Qnil;
   }
 
-  resultObj = rb_mysql_result_to_obj(result);
+  resultObj = rb_mysql_result_to_obj(result, Qnil);
   // pass-through query options for result construction later
   rb_iv_set(resultObj, "@query_options", rb_funcall(rb_iv_get(self, "@query_options"), rb_intern("dup"), 0));
 
 #ifdef HAVE_RUBY_ENCODING_H
   GetMysql2Result(resultObj, result_wrapper);
-  result_wrapper->encoding = wrapper->encoding;
+  RB_OBJ_WRITE(resultObj, &result_wrapper->encoding, wrapper->encoding);
 #endif
   return resultObj;
   
@@ -862,6 +1439,122 @@ static VALUE set_connect_timeout(VALUE self, VALUE value) {
   return value;
 }
 
+static VALUE set_shutdown_on_interrupt(VALUE self, VALUE value) {
+  GET_CLIENT(self);
+
+  wrapper->shutdown_on_interrupt = RTEST(value) ? 1 : 0;
+  return value;
+}
+
+static VALUE set_write_timeout(VALUE self, VALUE value) {
+  unsigned int write_timeout;
+  double sec;
+  GET_CLIENT(self);
+
+  if(!NIL_P(value)) {
+    sec = NUM2DBL(value);
+    if (sec < 0) {
+      rb_raise(cMysql2Error, "write_timeout must be a positive number, you passed %g", sec);
+    }
+    /* libmysql waits on the socket with its own timeout and only takes whole seconds, round up */
+    write_timeout = (unsigned int)sec;
+    if (write_timeout < sec) {
+      write_timeout++;
+    }
+    if(0 == write_timeout) return value;
+
+    if (mysql_options(wrapper->client, MYSQL_OPT_WRITE_TIMEOUT, &write_timeout)) {
+      rb_warn("%s\n", mysql_error(wrapper->client));
+    }
+  }
+  return value;
+}
+
+/*
+ * true for the classic zlib compression, or the name of an algorithm
+ * (:zlib, :zstd) on client libraries that let you pick one
+ */
+static VALUE set_compress(VALUE self, VALUE value) {
+  GET_CLIENT(self);
+
+  if (!RTEST(value)) {
+    return value;
+  }
+
+  if (value != Qtrue) {
+#ifdef HAVE_CONST_MYSQL_OPT_COMPRESSION_ALGORITHMS
+    VALUE algorithm = rb_obj_as_string(value);
+    if (mysql_options(wrapper->client, MYSQL_OPT_COMPRESSION_ALGORITHMS, StringValueCStr(algorithm)) == 0) {
+      return value;
+    }
+    rb_warn("%s, falling back to zlib\n", mysql_error(wrapper->client));
+#else
+    VALUE inspect = rb_inspect(value);
+    rb_warn("this version of libmysql can't pick a compression algorithm, using zlib instead of %s\n", StringValueCStr(inspect));
+#endif
+  }
+
+  if (mysql_options(wrapper->client, MYSQL_OPT_COMPRESS, NULL)) {
+    rb_warn("%s\n", mysql_error(wrapper->client));
+  }
+  return value;
+}
+
+static VALUE set_compression_level(VALUE self, VALUE value) {
+#ifdef HAVE_CONST_MYSQL_OPT_COMPRESSION_ALGORITHMS
+  unsigned int level;
+  GET_CLIENT(self);
+
+  if (!NIL_P(value)) {
+    level = NUM2UINT(value);
+    if (mysql_options(wrapper->client, MYSQL_OPT_ZSTD_COMPRESSION_LEVEL, &level)) {
+      rb_warn("%s\n", mysql_error(wrapper->client));
+    }
+  }
+#endif
+  return value;
+}
+
+static VALUE set_ssl_mode(VALUE self, VALUE value) {
+#ifdef HAVE_CONST_MYSQL_OPT_SSL_MODE
+  static const struct {
+    const char *name;
+    unsigned int mode;
+  } modes[] = {
+    { "disabled", SSL_MODE_DISABLED },
+    { "preferred", SSL_MODE_PREFERRED },
+    { "required", SSL_MODE_REQUIRED },
+    { "verify_ca", SSL_MODE_VERIFY_CA },
+    { "verify_identity", SSL_MODE_VERIFY_IDENTITY }
+  };
+  VALUE name;
+  const char *mode_name;
+  unsigned int i;
+  GET_CLIENT(self);
+
+  if (NIL_P(value)) {
+    return value;
+  }
+
+  name = rb_obj_as_string(value);
+  mode_name = StringValueCStr(name);
+  for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    if (strcmp(mode_name, modes[i].name) == 0) {
+      if (mysql_options(wrapper->client, MYSQL_OPT_SSL_MODE, &modes[i].mode)) {
+        rb_warn("%s\n", mysql_error(wrapper->client));
+      }
+      return value;
+    }
+  }
+  rb_raise(rb_eArgError, "unknown ssl_mode %s, expected disabled, preferred, required, verify_ca or verify_identity", mode_name);
+#else
+  if (!NIL_P(value)) {
+    rb_warn("this version of libmysql doesn't support :ssl_mode, ignoring it\n");
+  }
+  return value;
+#endif
+}
+
 static VALUE set_charset_name(VALUE self, VALUE value) {
   char * charset_name;
 #ifdef HAVE_RUBY_ENCODING_H
@@ -876,7 +1569,7 @@ static VALUE set_charset_name(VALUE self, VALUE value) {
     rb_raise(cMysql2Error, "Unsupported charset: '%s'", RSTRING_PTR(inspect));
   } else {
     if (wrapper->encoding == Qnil) {
-      wrapper->encoding = new_encoding;
+      RB_OBJ_WRITE(self, &wrapper->encoding, new_encoding);
     }
   }
 #endif
@@ -906,6 +1599,31 @@ static VALUE set_ssl_options(VALUE self, VALUE key, VALUE cert, VALUE ca, VALUE
   return self;
 }
 
+/*
+ * Drop the connection so #initialize can open a new one on this same
+ * object, see Client#reconnect!
+ */
+static VALUE reset_connection(VALUE self) {
+  GET_CLIENT(self);
+
+  reset_client(wrapper);
+  return self;
+}
+
+/* call-seq:
+ *    client.in_transaction?
+ *
+ * Whether the server reported a transaction open after the last statement.
+ */
+static VALUE rb_mysql_client_in_transaction(VALUE self) {
+  GET_CLIENT(self);
+
+  if (wrapper->closed) {
+    return Qfalse;
+  }
+  return (wrapper->client->server_status & SERVER_STATUS_IN_TRANS) ? Qtrue : Qfalse;
+}
+
 static VALUE init_connection(VALUE self) {
   GET_CLIENT(self);
 
@@ -944,6 +1662,10 @@ void init_mysql2_client() {
   rb_define_alloc_func(cMysql2Client, allocate);
 
   rb_define_singleton_method(cMysql2Client, "escape", rb_mysql_client_escape, 1);
+  rb_define_singleton_method(cMysql2Client, "wait_any", rb_mysql_client_wait_any, -1);
+  rb_define_singleton_method(cMysql2Client, "wait_all", rb_mysql_client_wait_all, -1);
+  rb_define_singleton_method(cMysql2Client, "thread_end", rb_mysql_client_thread_end, 0);
+  rb_funcall(cMysql2Client, rb_intern("private_class_method"), 1, ID2SYM(rb_intern("thread_end")));
 
   rb_define_method(cMysql2Client, "close", rb_mysql_client_close, 0);
   rb_define_method(cMysql2Client, "query", rb_mysql_client_query, -1);
@@ -960,15 +1682,22 @@ void init_mysql2_client() {
   rb_define_method(cMysql2Client, "more_results", rb_mysql_client_more_results, 0);
   rb_define_method(cMysql2Client, "next_result", rb_mysql_client_next_result, 0);
   rb_define_method(cMysql2Client, "store_result", rb_mysql_client_store_result, 0);
+  rb_define_method(cMysql2Client, "in_transaction?", rb_mysql_client_in_transaction, 0);
 #ifdef HAVE_RUBY_ENCODING_H
   rb_define_method(cMysql2Client, "encoding", rb_mysql_client_encoding, 0);
 #endif
 
   rb_define_private_method(cMysql2Client, "reconnect=", set_reconnect, 1);
   rb_define_private_method(cMysql2Client, "connect_timeout=", set_connect_timeout, 1);
+  rb_define_private_method(cMysql2Client, "write_timeout=", set_write_timeout, 1);
+  rb_define_private_method(cMysql2Client, "shutdown_on_interrupt=", set_shutdown_on_interrupt, 1);
+  rb_define_private_method(cMysql2Client, "compress=", set_compress, 1);
+  rb_define_private_method(cMysql2Client, "ssl_mode=", set_ssl_mode, 1);
+  rb_define_private_method(cMysql2Client, "compression_level=", set_compression_level, 1);
   rb_define_private_method(cMysql2Client, "charset_name=", set_charset_name, 1);
   rb_define_private_method(cMysql2Client, "ssl_set", set_ssl_options, 5);
   rb_define_private_method(cMysql2Client, "init_connection", init_connection, 0);
+  rb_define_private_method(cMysql2Client, "reset_connection", reset_connection, 0);
   rb_define_private_method(cMysql2Client, "connect", rb_connect, 7);
 
   intern_encoding_from_charset = rb_intern("encoding_from_charset");
@@ -980,8 +1709,23 @@ void init_mysql2_client() {
   sym_as              = ID2SYM(rb_intern("as"));
   sym_array           = ID2SYM(rb_intern("array"));
   sym_stream          = ID2SYM(rb_intern("stream"));
+  sym_cache           = ID2SYM(rb_intern("cache"));
+  sym_spill           = ID2SYM(rb_intern("spill"));
+  sym_timeout         = ID2SYM(rb_intern("timeout"));
+  sym_on_timeout      = ID2SYM(rb_intern("on_timeout"));
+  sym_cancel          = ID2SYM(rb_intern("cancel"));
+  sym_connect_time    = ID2SYM(rb_intern("connect_time"));
+  sym_ssl_cipher      = ID2SYM(rb_intern("ssl_cipher"));
+  sym_ssl_session_reused = ID2SYM(rb_intern("ssl_session_reused"));
 
   intern_merge = rb_intern("merge");
+  intern_cancel = rb_intern("cancel");
+  intern_reconnect_after_fork = rb_intern("reconnect_after_fork");
+
+#ifdef HAVE_MYSQL_GET_SSL_SESSION_DATA
+  ssl_session_cache = rb_hash_new();
+  rb_global_variable(&ssl_session_cache);
+#endif
   intern_error_number_eql = rb_intern("error_number=");
   intern_sql_state_eql = rb_intern("sql_state=");
 
@@ -30,13 +30,26 @@ rb_thread_blocking_region(
 #endif /* ! HAVE_RB_THREAD_BLOCKING_REGION */
 
 void init_mysql2_client();
+void rb_mysql_client_unblock(void *mysql);
 
 typedef struct {
   VALUE encoding;
   VALUE active_thread; /* rb_thread_current() or Qnil */
   int reconnect_enabled;
   int closed;
+  int shutdown_on_interrupt; /* :shutdown_on_interrupt, see rb_mysql_client_unblock */
+  rb_pid_t connect_pid;  /* process that connected, 0 until then */
   MYSQL *client;
 } mysql_client_wrapper;
 
+/* the unblock function for a blocking libmysql call on wrapper's connection */
+#define MYSQL2_CLIENT_UBF(wrapper) ((wrapper)->shutdown_on_interrupt ? rb_mysql_client_unblock : RUBY_UBF_IO)
+
+/* raises the connection's last error as a Mysql2::Error with its error_number and sql_state */
+VALUE rb_raise_mysql2_error(mysql_client_wrapper *wrapper);
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+extern const rb_data_type_t rb_mysql_client_type;
+#endif
+
 #endif
@@ -8,6 +8,13 @@ end
 # 1.9-only
 have_func('rb_thread_blocking_region')
 have_func('rb_wait_for_single_fd')
+have_func('rb_rational_new')
+have_func('rb_gc_adjust_memory_usage')
+have_func('rb_gc_mark_movable')
+have_type('rb_data_type_t', 'ruby.h')
+have_header('pthread.h')
+have_header('poll.h')
+have_header('sys/mman.h')
 
 # borrowed from mysqlplus
 # http://github.com/oldmoe/mysqlplus/blob/master/ext/extconf.rb
@@ -62,6 +69,16 @@ end
   asplode h unless have_header h
 end
 
+mysql_h = [prefix, 'mysql.h'].compact.join('/')
+# MySQL 5.7.11+
+have_const('MYSQL_OPT_SSL_MODE', mysql_h)
+# MySQL 8.0.18+, zstd protocol compression
+have_const('MYSQL_OPT_COMPRESSION_ALGORITHMS', mysql_h)
+# MySQL 8.0.29+, TLS session resumption
+have_func('mysql_get_ssl_session_data', mysql_h)
+# MySQL 5.7+ (not MariaDB), reading the binary log as a replica
+have_func('mysql_binlog_open', mysql_h)
+
 # GCC specific flags
 if RbConfig::MAKEFILE_CONFIG['CC'] =~ /gcc/
   $CFLAGS << ' -Wall -funroll-loops'
@@ -6,7 +6,16 @@ VALUE mMysql2, cMysql2Error;
 void Init_mysql2() {
   mMysql2      = rb_define_module("Mysql2");
   cMysql2Error = rb_const_get(mMysql2, rb_intern("Error"));
+  rb_global_variable(&cMysql2Error);
+
+  // mysql_init does this on first use too, but not safely when several
+  // threads get there at once, like Client.connect_many's do
+  if (mysql_library_init(0, NULL, NULL) != 0) {
+    rb_raise(rb_eRuntimeError, "couldn't initialize the MySQL client library");
+  }
 
   init_mysql2_client();
   init_mysql2_result();
+  init_mysql2_cache();
+  init_mysql2_binlog();
 }
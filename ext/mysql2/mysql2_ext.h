@@ -36,7 +36,23 @@ typedef unsigned int    uint;
 #define RB_MYSQL_UNUSED
 #endif
 
+/*
+ * write barriers and GC compaction only exist on newer rubies, on older ones
+ * stores are plain assignments and marked objects never move
+ */
+#ifndef RB_OBJ_WRITE
+#define RB_OBJ_WRITE(obj, slot, val) (*(slot) = (val))
+#endif
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+#define mysql2_gc_location(ptr) ptr = rb_gc_location(ptr)
+#else
+#define rb_gc_mark_movable(ptr) rb_gc_mark(ptr)
+#endif
+
 #include <client.h>
 #include <result.h>
+#include <cache.h>
+#include <binlog.h>
 
 #endif
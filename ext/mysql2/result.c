@@ -1,5 +1,13 @@
 #include <mysql2_ext.h>
 #include <stdint.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #ifdef HAVE_RUBY_ENCODING_H
 static rb_encoding *binaryEncoding;
@@ -48,30 +56,113 @@ static rb_encoding *binaryEncoding;
 #endif
 
 static VALUE cMysql2Result;
-static VALUE cBigDecimal, cDate, cDateTime;
+
+/* 10^0 .. 10^18, the largest powers of ten that fit in an int64_t */
+static const int64_t mysql2_pow10[] = {
+  1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+  100000000LL, 1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL,
+  10000000000000LL, 100000000000000LL, 1000000000000000LL,
+  10000000000000000LL, 100000000000000000LL, 1000000000000000000LL
+};
+#define MYSQL2_MAX_DECIMAL_SCALE 18
+
+/* :decode_threads limits, and how many rows get decoded per round */
+#define MYSQL2_MAX_DECODE_THREADS 16
+#define MYSQL2_DECODE_MIN_ROWS_PER_THREAD 256
+#define MYSQL2_DECODE_BATCH_ROWS 8192
+
+/* the most distinct values we'll intern for a single column */
+#define MYSQL2_MAX_INTERNED_PER_FIELD 64
+
+/* MYSQL_TYPE_JSON, which older headers don't have */
+#define MYSQL2_TYPE_JSON 245
+
+/* how DECIMAL columns with a non-zero scale are handed back to the caller */
+enum mysql2_decimal_as {
+  DECIMAL_AS_BIG_DECIMAL = 0,
+  DECIMAL_AS_FLOAT,
+  DECIMAL_AS_RATIONAL,
+  DECIMAL_AS_SCALED_INT
+};
+
+static VALUE cBigDecimal, cDate, cDateTime, cJSON = Qnil;
 static VALUE opt_decimal_zero, opt_float_zero, opt_time_year, opt_time_month, opt_utc_offset;
 extern VALUE mMysql2, cMysql2Client, cMysql2Error;
 static VALUE intern_encoding_from_charset;
-static ID intern_new, intern_utc, intern_local, intern_encoding_from_charset_code,
+static ID intern_new, intern_members, intern_call, intern_parse, intern_to_r, intern_to_i, intern_mult, intern_pow, intern_utc, intern_local, intern_encoding_from_charset_code,
           intern_localtime, intern_local_offset, intern_civil, intern_new_offset;
 static VALUE sym_symbolize_keys, sym_as, sym_array, sym_database_timezone, sym_application_timezone,
-          sym_local, sym_utc, sym_cast_booleans, sym_cache_rows, sym_cast, sym_stream;
+          sym_local, sym_utc, sym_cast_booleans, sym_cache_rows, sym_cast, sym_stream,
+          sym_decimal_as, sym_big_decimal, sym_float, sym_rational, sym_scaled_int, sym_intern,
+          sym_freeze_strings, sym_decode_threads, sym_prefetch,
+          sym_columns, sym_skip_columns, sym_casters, sym_string, sym_boolean, sym_unsigned, sym_json, sym_uuid;
 static ID intern_merge;
 
 static void rb_mysql_result_mark(void * wrapper) {
   mysql2_result_wrapper * w = wrapper;
   if (w) {
-    rb_gc_mark(w->fields);
-    rb_gc_mark(w->rows);
-    rb_gc_mark(w->encoding);
+    rb_gc_mark_movable(w->fields);
+    rb_gc_mark_movable(w->rows);
+    rb_gc_mark_movable(w->encoding);
+    rb_gc_mark_movable(w->internedStrings);
+    rb_gc_mark_movable(w->client);
+    rb_gc_mark_movable(w->rowClass);
+    rb_gc_mark_movable(w->columnsFor);
+    rb_gc_mark_movable(w->castersFor);
+    rb_gc_mark_movable(w->casterCalls);
   }
 }
 
+/*
+ * Number of bytes libmysql allocated for the rows of a stored result, so
+ * the GC can take memory it otherwise knows nothing about into account.
+ * The rows are walked once, they're all in memory already, and the cursor
+ * is put back at the first one.
+ */
+static size_t mysql2_result_data_size(MYSQL_RES * result) {
+  unsigned int numberOfFields, i;
+  unsigned long *lengths;
+  size_t size = 0;
+
+  numberOfFields = mysql_num_fields(result);
+  while (mysql_fetch_row(result) != NULL) {
+    lengths = mysql_fetch_lengths(result);
+    size += sizeof(MYSQL_ROWS) + (numberOfFields + 1) * sizeof(char *);
+    for (i = 0; i < numberOfFields; i++) {
+      size += lengths[i] + 1;
+    }
+  }
+  mysql_data_seek(result, 0);
+  return size;
+}
+
+#ifdef HAVE_PTHREAD_H
+static void rb_mysql_result_free_prefetch(mysql2_result_wrapper * wrapper);
+#endif
+#ifdef HAVE_SYS_MMAN_H
+static void rb_mysql_result_free_spill(mysql2_result_wrapper * wrapper);
+#endif
+
 /* this may be called manually or during GC */
 static void rb_mysql_result_free_result(mysql2_result_wrapper * wrapper) {
   if (wrapper && wrapper->resultFreed != 1) {
-    mysql_free_result(wrapper->result);
+#ifdef HAVE_PTHREAD_H
+    rb_mysql_result_free_prefetch(wrapper);
+#endif
+#ifdef HAVE_SYS_MMAN_H
+    rb_mysql_result_free_spill(wrapper);
+#endif
+    if (wrapper->cacheEntry) {
+      mysql2_cache_release(wrapper->cacheEntry);
+      wrapper->cacheEntry = NULL;
+    } else {
+      mysql_free_result(wrapper->result);
+    }
     wrapper->resultFreed = 1;
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+    rb_gc_adjust_memory_usage(-(ssize_t)wrapper->resultSize);
+#endif
+    wrapper->resultSize = 0;
   }
 }
 
@@ -80,9 +171,52 @@ static void rb_mysql_result_free(void * wrapper) {
   mysql2_result_wrapper * w = wrapper;
   /* FIXME: this may call flush_use_result, which can hit the socket */
   rb_mysql_result_free_result(w);
+  xfree(w->rowMembers);
+  xfree(w->columns);
+  xfree(w->casters);
   xfree(wrapper);
 }
 
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+static size_t rb_mysql_result_memsize(const void * wrapper) {
+  const mysql2_result_wrapper * w = wrapper;
+  return sizeof(mysql2_result_wrapper) + w->resultSize;
+}
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+static void rb_mysql_result_compact(void * wrapper) {
+  mysql2_result_wrapper * w = wrapper;
+
+  mysql2_gc_location(w->fields);
+  mysql2_gc_location(w->rows);
+  mysql2_gc_location(w->encoding);
+  mysql2_gc_location(w->internedStrings);
+  mysql2_gc_location(w->client);
+  mysql2_gc_location(w->rowClass);
+  mysql2_gc_location(w->columnsFor);
+  mysql2_gc_location(w->castersFor);
+  mysql2_gc_location(w->casterCalls);
+}
+#endif
+
+const rb_data_type_t rb_mysql_result_type = {
+  "rb_mysql_result",
+  {
+    rb_mysql_result_mark,
+    rb_mysql_result_free,
+    rb_mysql_result_memsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    rb_mysql_result_compact,
+#endif
+  },
+  0,
+  0,
+#ifdef RUBY_TYPED_WB_PROTECTED
+  RUBY_TYPED_WB_PROTECTED,
+#endif
+};
+#endif
+
 /*
  * for small results, this won't hit the network, but there's no
  * reliable way for us to tell this so we'll always release the GVL
@@ -101,7 +235,7 @@ static VALUE rb_mysql_result_fetch_field(VALUE self, unsigned int idx, short int
 
   if (wrapper->fields == Qnil) {
     wrapper->numberOfFields = mysql_num_fields(wrapper->result);
-    wrapper->fields = rb_ary_new2(wrapper->numberOfFields);
+    RB_OBJ_WRITE(self, &wrapper->fields, rb_ary_new2(wrapper->numberOfFields));
   }
 
   rb_field = rb_ary_entry(wrapper->fields, idx);
@@ -162,56 +296,652 @@ static VALUE mysql2_set_field_string_encoding(VALUE val, MYSQL_FIELD field, rb_e
 }
 #endif
 
+/* options for a single Mysql2::Result#each call, resolved once up front */
+typedef struct {
+  int symbolizeKeys;
+  int asArray;
+  int castBool;
+  int cast;
+  int decimalAs;
+  ID db_timezone;
+  ID app_timezone;
+  MYSQL_FIELD *fields;
+  char *intern; /* per-field flags, or NULL if nothing gets interned */
+  int freezeStrings;
+  VALUE rowClass;           /* :as => SomeClass, instantiated for every row, or nil */
+  VALUE columns;            /* the names given to :columns or :skip_columns, or nil for every field */
+  int skipColumns;
+  VALUE casters;            /* the :casters Hash, or nil */
+} result_each_args;
 
-static VALUE rb_mysql_result_fetch_row(VALUE self, ID db_timezone, ID app_timezone, int symbolizeKeys, int asArray, int castBool, int cast, MYSQL_FIELD * fields) {
-  VALUE rowVal;
-  mysql2_result_wrapper * wrapper;
-  MYSQL_ROW row;
-  unsigned int i = 0;
-  unsigned long * fieldLengths;
-  void * ptr;
+/*
+ * :decode_threads parses numeric and date fields of a stored result into
+ * these on worker threads without the GVL, leaving only the boxing into Ruby
+ * objects for the thread holding it. Anything else stays MYSQL2_CELL_RAW and
+ * is cast the usual way.
+ */
+enum mysql2_cell_kind {
+  MYSQL2_CELL_RAW = 0,
+  MYSQL2_CELL_INT,
+  MYSQL2_CELL_DOUBLE,
+  MYSQL2_CELL_DATETIME,
+  MYSQL2_CELL_DATE
+};
+
+typedef struct {
+  char kind;
+  union {
+    int64_t i;
+    double d;
+    struct {
+      unsigned int year, month, day, hour, min, sec;
+    } t;
+  } v;
+} mysql2_cell;
+
+/*
+ * ENUM and SET fields are always interned when :intern is set, other fields
+ * only if their name is in the :intern array
+ */
+static void mysql2_intern_fields(MYSQL_FIELD *fields, unsigned int numberOfFields, VALUE internOpt, char *intern) {
+  unsigned int i;
+  long j;
+
+  for (i = 0; i < numberOfFields; i++) {
+    intern[i] = (fields[i].flags & (ENUM_FLAG | SET_FLAG)) ||
+                fields[i].type == MYSQL_TYPE_ENUM || fields[i].type == MYSQL_TYPE_SET;
+  }
+
+  if (TYPE(internOpt) == T_ARRAY) {
+    for (j = 0; j < RARRAY_LEN(internOpt); j++) {
+      VALUE name = rb_obj_as_string(rb_ary_entry(internOpt, j));
+      for (i = 0; i < numberOfFields; i++) {
+        if (fields[i].name_length == RSTRING_LEN(name) &&
+            memcmp(fields[i].name, RSTRING_PTR(name), fields[i].name_length) == 0) {
+          intern[i] = 1;
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Look for a previously returned String with the same raw bytes in this
+ * field's intern table, returns Qnil if there isn't one yet.
+ *
+ * Each table is a flat array of [raw, value, raw, value, ...] pairs, which
+ * is plenty fast for the handful of distinct values we expect here.
+ */
+static VALUE mysql2_intern_lookup(mysql2_result_wrapper * wrapper, unsigned int idx, const char *str, unsigned long len) {
+  VALUE table;
+  long j;
+
+  if (NIL_P(wrapper->internedStrings)) {
+    return Qnil;
+  }
+  table = rb_ary_entry(wrapper->internedStrings, idx);
+  if (NIL_P(table)) {
+    return Qnil;
+  }
+
+  for (j = 0; j < RARRAY_LEN(table); j += 2) {
+    VALUE raw = RARRAY_PTR(table)[j];
+    if ((unsigned long)RSTRING_LEN(raw) == len && memcmp(RSTRING_PTR(raw), str, len) == 0) {
+      return RARRAY_PTR(table)[j+1];
+    }
+  }
+  return Qnil;
+}
+
+/* freeze +val+ and remember it for later rows, unless the table is full */
+static VALUE mysql2_intern_store(VALUE self, mysql2_result_wrapper * wrapper, unsigned int idx, const char *str, unsigned long len, VALUE val) {
+  VALUE table;
+
+  if (NIL_P(wrapper->internedStrings)) {
+    RB_OBJ_WRITE(self, &wrapper->internedStrings, rb_ary_new2(wrapper->numberOfFields));
+  }
+  table = rb_ary_entry(wrapper->internedStrings, idx);
+  if (NIL_P(table)) {
+    table = rb_ary_new();
+    rb_ary_store(wrapper->internedStrings, idx, table);
+  }
+
+  if (RARRAY_LEN(table) < MYSQL2_MAX_INTERNED_PER_FIELD * 2) {
+    VALUE raw = rb_str_new(str, len);
+    OBJ_FREEZE(raw);
+    OBJ_FREEZE(val);
+    rb_ary_push(table, raw);
+    rb_ary_push(table, val);
+  }
+  return val;
+}
+
+/*
+ * Parse the textual DECIMAL +str+ (as sent by the server) into an integer
+ * scaled by 10^+scale+, without going through a Ruby String.
+ *
+ * Returns 0 if the value doesn't fit into an int64_t (or isn't in the
+ * expected format), in which case the caller falls back to BigDecimal.
+ */
+static int mysql2_decimal_to_scaled(const char *str, unsigned long len, unsigned int scale, int64_t *out) {
+  const char *end = str + len;
+  uint64_t mantissa = 0;
+  unsigned int fraction = 0;
+  int negative = 0, seen_point = 0;
+
+  if (scale > MYSQL2_MAX_DECIMAL_SCALE) {
+    return 0;
+  }
+
+  if (str < end && (*str == '-' || *str == '+')) {
+    negative = *str == '-';
+    str++;
+  }
+
+  for (; str < end; str++) {
+    if (*str == '.') {
+      if (seen_point) return 0;
+      seen_point = 1;
+      continue;
+    }
+    if (*str < '0' || *str > '9') return 0;
+    if (seen_point && ++fraction > scale) return 0;
+    if (mantissa > (INT64_MAX - 9) / 10) return 0;
+    mantissa = mantissa * 10 + (*str - '0');
+  }
+
+  for (; fraction < scale; fraction++) {
+    if (mantissa > INT64_MAX / 10) return 0;
+    mantissa *= 10;
+  }
+
+  *out = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+  return 1;
+}
+
+static VALUE mysql2_cast_decimal(const char *str, unsigned long len, unsigned int scale, int decimalAs) {
+  int64_t scaled;
+  VALUE val;
+
+  switch (decimalAs) {
+  case DECIMAL_AS_FLOAT: {
+    double column_to_double = strtod(str, NULL);
+    if (column_to_double == 0.000000) {
+      return opt_float_zero;
+    }
+    return rb_float_new(column_to_double);
+  }
+  case DECIMAL_AS_RATIONAL:
+    if (mysql2_decimal_to_scaled(str, len, scale, &scaled)) {
+#ifdef HAVE_RB_RATIONAL_NEW
+      return rb_rational_new(LL2NUM(scaled), LL2NUM(mysql2_pow10[scale]));
+#else
+      return rb_funcall(rb_mKernel, rb_intern("Rational"), 2, LL2NUM(scaled), LL2NUM(mysql2_pow10[scale]));
+#endif
+    }
+    break;
+  case DECIMAL_AS_SCALED_INT:
+    if (mysql2_decimal_to_scaled(str, len, scale, &scaled)) {
+      return LL2NUM(scaled);
+    }
+    break;
+  }
+
+  if (strtod(str, NULL) == 0.000000) {
+    val = rb_funcall(cBigDecimal, intern_new, 1, opt_decimal_zero);
+  } else {
+    val = rb_funcall(cBigDecimal, intern_new, 1, rb_str_new(str, len));
+  }
+
+  // the value didn't fit into 64 bits, let BigDecimal do the heavy lifting
+  if (decimalAs == DECIMAL_AS_RATIONAL) {
+    val = rb_funcall(val, intern_to_r, 0);
+  } else if (decimalAs == DECIMAL_AS_SCALED_INT) {
+    val = rb_funcall(val, intern_mult, 1, rb_funcall(INT2FIX(10), intern_pow, 1, UINT2NUM(scale)));
+    val = rb_funcall(val, intern_to_i, 0);
+  }
+  return val;
+}
+
+/*
+ * shared by the regular and the pre-decoded (:decode_threads) paths,
+ * +raw+ is only used for error messages
+ */
+static VALUE mysql2_build_datetime(const result_each_args * args, unsigned int year, unsigned int month, unsigned int day,
+                                   unsigned int hour, unsigned int min, unsigned int sec, const char *raw) {
+  VALUE val;
+  uint64_t seconds;
+
+  seconds = (year*31557600ULL) + (month*2592000ULL) + (day*86400ULL) + (hour*3600ULL) + (min*60ULL) + sec;
+
+  if (seconds == 0) {
+    val = Qnil;
+  } else {
+    if (month < 1 || day < 1) {
+      rb_raise(cMysql2Error, "Invalid date: %s", raw);
+      val = Qnil;
+    } else {
+      if (seconds < MYSQL2_MIN_TIME || seconds > MYSQL2_MAX_TIME) { // use DateTime instead
+        VALUE offset = INT2NUM(0);
+        if (args->db_timezone == intern_local) {
+          offset = rb_funcall(cMysql2Client, intern_local_offset, 0);
+        }
+        val = rb_funcall(cDateTime, intern_civil, 7, INT2NUM(year), INT2NUM(month), INT2NUM(day), INT2NUM(hour), INT2NUM(min), INT2NUM(sec), offset);
+        if (!NIL_P(args->app_timezone)) {
+          if (args->app_timezone == intern_local) {
+            offset = rb_funcall(cMysql2Client, intern_local_offset, 0);
+            val = rb_funcall(val, intern_new_offset, 1, offset);
+          } else { // utc
+            val = rb_funcall(val, intern_new_offset, 1, opt_utc_offset);
+          }
+        }
+      } else {
+        val = rb_funcall(rb_cTime, args->db_timezone, 6, INT2NUM(year), INT2NUM(month), INT2NUM(day), INT2NUM(hour), INT2NUM(min), INT2NUM(sec));
+        if (!NIL_P(args->app_timezone)) {
+          if (args->app_timezone == intern_local) {
+            val = rb_funcall(val, intern_localtime, 0);
+          } else { // utc
+            val = rb_funcall(val, intern_utc, 0);
+          }
+        }
+      }
+    }
+  }
+  return val;
+}
+
+static VALUE mysql2_build_date(int year, int month, int day, const char *raw) {
+  VALUE val;
+
+  if (year+month+day == 0) {
+    val = Qnil;
+  } else {
+    if (month < 1 || day < 1) {
+      rb_raise(cMysql2Error, "Invalid date: %s", raw);
+      val = Qnil;
+    } else {
+      val = rb_funcall(cDate, intern_new, 3, INT2NUM(year), INT2NUM(month), INT2NUM(day));
+    }
+  }
+  return val;
+}
+
+static VALUE mysql2_box_cell(const result_each_args * args, const mysql2_cell * cell, const char *raw) {
+  switch (cell->kind) {
+  case MYSQL2_CELL_INT:
+    return LL2NUM(cell->v.i);
+  case MYSQL2_CELL_DOUBLE:
+    if (cell->v.d == 0.000000) {
+      return opt_float_zero;
+    }
+    return rb_float_new(cell->v.d);
+  case MYSQL2_CELL_DATETIME:
+    return mysql2_build_datetime(args, cell->v.t.year, cell->v.t.month, cell->v.t.day,
+                                 cell->v.t.hour, cell->v.t.min, cell->v.t.sec, raw);
+  case MYSQL2_CELL_DATE:
+    return mysql2_build_date(cell->v.t.year, cell->v.t.month, cell->v.t.day, raw);
+  }
+  return Qnil;
+}
+
+/*
+ * Which field goes into each argument of the :as class's new: a Struct's
+ * members are matched to the fields by name, other classes get every field
+ * (or those :columns picks) in order. Worked out once per result, not per row.
+ */
+static void mysql2_resolve_row_class(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args) {
+  int *members = NULL;
+  unsigned int arity = wrapper->numberOfFields;
+
+  if (rb_class_inherited_p(args->rowClass, rb_cStruct) == Qtrue) {
+    VALUE names = rb_funcall(args->rowClass, intern_members, 0);
+    unsigned int m, i;
+
+    arity = (unsigned int)RARRAY_LEN(names);
+    members = ALLOC_N(int, arity);
+    for (m = 0; m < arity; m++) {
+      const char *name = rb_id2name(SYM2ID(rb_ary_entry(names, m)));
+      members[m] = -1;
+      for (i = 0; i < wrapper->numberOfFields; i++) {
+        if (strcmp(args->fields[i].name, name) == 0) {
+          members[m] = i;
+          break;
+        }
+      }
+    }
+  }
+
+  xfree(wrapper->rowMembers);
+  wrapper->rowMembers = members;
+  wrapper->rowArity = arity;
+  RB_OBJ_WRITE(self, &wrapper->rowClass, args->rowClass);
+}
+
+/* the index of the field called +name+ (a String or Symbol), or -1 */
+static int mysql2_field_index(const result_each_args * args, unsigned int numberOfFields, VALUE name) {
+  unsigned int i;
+
+  name = rb_obj_as_string(name);
+  for (i = 0; i < numberOfFields; i++) {
+    if (args->fields[i].name_length == (unsigned long)RSTRING_LEN(name) &&
+        memcmp(args->fields[i].name, RSTRING_PTR(name), RSTRING_LEN(name)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * The fields :columns (in the order given) or :skip_columns (all the others)
+ * leave in a row. Worked out once per result like the :as class, the rows
+ * then never look at the other fields.
+ */
+static void mysql2_resolve_columns(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args) {
+  unsigned int *columns;
+  unsigned int numberOfColumns = 0, i;
+  long n, numberOfNames = RARRAY_LEN(args->columns);
+
+  columns = ALLOC_N(unsigned int, args->skipColumns ? wrapper->numberOfFields : (unsigned int)numberOfNames);
+  if (args->skipColumns) {
+    char *skip = ALLOCA_N(char, wrapper->numberOfFields + 1);
+    MEMZERO(skip, char, wrapper->numberOfFields);
+    for (n = 0; n < numberOfNames; n++) {
+      int index = mysql2_field_index(args, wrapper->numberOfFields, rb_ary_entry(args->columns, n));
+      if (index >= 0) {
+        skip[index] = 1;
+      }
+    }
+    for (i = 0; i < wrapper->numberOfFields; i++) {
+      if (!skip[i]) {
+        columns[numberOfColumns++] = i;
+      }
+    }
+  } else {
+    for (n = 0; n < numberOfNames; n++) {
+      VALUE name = rb_ary_entry(args->columns, n);
+      int index = mysql2_field_index(args, wrapper->numberOfFields, name);
+      if (index < 0) {
+        xfree(columns);
+        name = rb_obj_as_string(name);
+        rb_raise(rb_eArgError, "no field named %s in this result", StringValueCStr(name));
+      }
+      columns[numberOfColumns++] = index;
+    }
+  }
+
+  xfree(wrapper->columns);
+  wrapper->columns = columns;
+  wrapper->numberOfColumns = numberOfColumns;
+  wrapper->columnsSkip = args->skipColumns;
+  RB_OBJ_WRITE(self, &wrapper->columnsFor, args->columns);
+}
+
+/*
+ * :casters => { key => caster } replaces the usual casting of the fields it
+ * matches. A key is a field name (String), a column type (Symbol, see
+ * mysql2_type_name) or :unsigned for any UNSIGNED integer field, tried in
+ * that order. A caster is one of the builtin Symbols below or anything that
+ * responds to call, which gets the field's String.
+ */
+enum mysql2_caster {
+  MYSQL2_CASTER_NONE = 0,
+  MYSQL2_CASTER_STRING,   /* :string, the String as it came in */
+  MYSQL2_CASTER_BOOLEAN,  /* :boolean, false for 0 (or a zero BIT), true otherwise */
+  MYSQL2_CASTER_UNSIGNED, /* :unsigned, an Integer from the full 64 bit unsigned range */
+  MYSQL2_CASTER_JSON,     /* :json, parsed with JSON.parse */
+  MYSQL2_CASTER_UUID,     /* :uuid, a 16 byte binary UUID as its dashed hex form */
+  MYSQL2_CASTER_CALL      /* anything else, called with the String */
+};
+
+/* the name a column type goes by as a :casters key, or NULL */
+static const char *mysql2_type_name(const MYSQL_FIELD *field) {
+  int binary = field->charsetnr == 63;
+
+  if (field->flags & ENUM_FLAG) {
+    return "enum";
+  }
+  if (field->flags & SET_FLAG) {
+    return "set";
+  }
+
+  switch (field->type) {
+  case MYSQL_TYPE_TINY:        return "tinyint";
+  case MYSQL_TYPE_SHORT:       return "smallint";
+  case MYSQL_TYPE_INT24:       return "mediumint";
+  case MYSQL_TYPE_LONG:        return "int";
+  case MYSQL_TYPE_LONGLONG:    return "bigint";
+  case MYSQL_TYPE_DECIMAL:
+  case MYSQL_TYPE_NEWDECIMAL:  return "decimal";
+  case MYSQL_TYPE_FLOAT:       return "float";
+  case MYSQL_TYPE_DOUBLE:      return "double";
+  case MYSQL_TYPE_BIT:         return "bit";
+  case MYSQL_TYPE_YEAR:        return "year";
+  case MYSQL_TYPE_DATE:
+  case MYSQL_TYPE_NEWDATE:     return "date";
+  case MYSQL_TYPE_TIME:        return "time";
+  case MYSQL_TYPE_DATETIME:    return "datetime";
+  case MYSQL_TYPE_TIMESTAMP:   return "timestamp";
+  case MYSQL_TYPE_GEOMETRY:    return "geometry";
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:        return binary ? "blob" : "text";
+  case MYSQL_TYPE_STRING:      return binary ? "binary" : "char";
+  case MYSQL_TYPE_VAR_STRING:
+  case MYSQL_TYPE_VARCHAR:     return binary ? "varbinary" : "varchar";
+  default:
+    if (field->type == MYSQL2_TYPE_JSON) {
+      return "json";
+    }
+    return NULL;
+  }
+}
+
+static int mysql2_is_integer_type(enum enum_field_types type) {
+  return type == MYSQL_TYPE_TINY || type == MYSQL_TYPE_SHORT || type == MYSQL_TYPE_INT24 ||
+         type == MYSQL_TYPE_LONG || type == MYSQL_TYPE_LONGLONG;
+}
+
+/*
+ * The caster of every field, worked out once per result so a row only
+ * looks at a char per field instead of the :casters Hash.
+ */
+static void mysql2_resolve_casters(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args) {
+  char *casters = ALLOC_N(char, wrapper->numberOfFields);
+  VALUE calls = rb_ary_new2(wrapper->numberOfFields);
+  unsigned int i;
+
+  for (i = 0; i < wrapper->numberOfFields; i++) {
+    const char *typeName = mysql2_type_name(&args->fields[i]);
+    VALUE caster = rb_hash_aref(args->casters, rb_str_new(args->fields[i].name, args->fields[i].name_length));
+
+    if (NIL_P(caster) && typeName) {
+      caster = rb_hash_aref(args->casters, ID2SYM(rb_intern(typeName)));
+    }
+    if (NIL_P(caster) && (args->fields[i].flags & UNSIGNED_FLAG) && mysql2_is_integer_type(args->fields[i].type)) {
+      caster = rb_hash_aref(args->casters, sym_unsigned);
+    }
+
+    rb_ary_push(calls, Qnil);
+    if (NIL_P(caster)) {
+      casters[i] = MYSQL2_CASTER_NONE;
+    } else if (caster == sym_string) {
+      casters[i] = MYSQL2_CASTER_STRING;
+    } else if (caster == sym_boolean) {
+      casters[i] = MYSQL2_CASTER_BOOLEAN;
+    } else if (caster == sym_unsigned) {
+      casters[i] = MYSQL2_CASTER_UNSIGNED;
+    } else if (caster == sym_json) {
+      if (NIL_P(cJSON)) {
+        rb_require("json");
+        cJSON = rb_const_get(rb_cObject, rb_intern("JSON"));
+        rb_global_variable(&cJSON);
+      }
+      casters[i] = MYSQL2_CASTER_JSON;
+    } else if (caster == sym_uuid) {
+      casters[i] = MYSQL2_CASTER_UUID;
+    } else if (rb_respond_to(caster, intern_call)) {
+      casters[i] = MYSQL2_CASTER_CALL;
+      rb_ary_store(calls, i, caster);
+    } else {
+      xfree(casters);
+      rb_raise(rb_eArgError, "unknown caster for %s, use :string, :boolean, :unsigned, :json, :uuid or something that responds to call",
+               args->fields[i].name);
+    }
+  }
+
+  xfree(wrapper->casters);
+  wrapper->casters = casters;
+  RB_OBJ_WRITE(self, &wrapper->casterCalls, calls);
+  RB_OBJ_WRITE(self, &wrapper->castersFor, args->casters);
+}
+
+/* +str+ is the field as a String for the casters that need one, nil for the others */
+static VALUE mysql2_apply_caster(mysql2_result_wrapper * wrapper, unsigned int i, const char *raw, unsigned long length,
+                                 const MYSQL_FIELD *field, VALUE str) {
+  switch (wrapper->casters[i]) {
+  case MYSQL2_CASTER_BOOLEAN:
+    if (field->type == MYSQL_TYPE_BIT) {
+      unsigned long n;
+      for (n = 0; n < length; n++) {
+        if (raw[n]) {
+          return Qtrue;
+        }
+      }
+      return Qfalse;
+    }
+    return strtod(raw, NULL) != 0 ? Qtrue : Qfalse;
+  case MYSQL2_CASTER_UNSIGNED:
+    return ULL2NUM(strtoull(raw, NULL, 10));
+  case MYSQL2_CASTER_JSON:
+    return rb_funcall(cJSON, intern_parse, 1, str);
+  case MYSQL2_CASTER_UUID:
+    if (length == 16) {
+      static const char hex[] = "0123456789abcdef";
+      char uuid[36];
+      unsigned long n, o = 0;
+
+      for (n = 0; n < 16; n++) {
+        if (n == 4 || n == 6 || n == 8 || n == 10) {
+          uuid[o++] = '-';
+        }
+        uuid[o++] = hex[(unsigned char)raw[n] >> 4];
+        uuid[o++] = hex[(unsigned char)raw[n] & 0x0f];
+      }
+      return rb_usascii_str_new(uuid, sizeof(uuid));
+    }
+    // already text
+    return str;
+  case MYSQL2_CASTER_CALL:
+    return rb_funcall(rb_ary_entry(wrapper->casterCalls, i), intern_call, 1, str);
+  default:
+    return str;
+  }
+}
+
+/*
+ * Turn a row into a Hash, an Array or an instance of the :as class. +cells+
+ * holds the values decoded ahead of time by the :decode_threads workers, or
+ * is NULL to cast every field here.
+ */
+static VALUE rb_mysql_result_build_row(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args,
+                                       MYSQL_ROW row, unsigned long * fieldLengths, const mysql2_cell * cells) {
+  MYSQL_FIELD * fields = args->fields;
+  VALUE rowVal = Qnil;
+  VALUE *values = NULL;
+  const unsigned int *columns = NULL;
+  const char *casters = NULL;
+  unsigned int i = 0, k, numberOfValues;
 #ifdef HAVE_RUBY_ENCODING_H
   rb_encoding *default_internal_enc;
   rb_encoding *conn_enc;
-#endif
-  GetMysql2Result(self, wrapper);
 
-#ifdef HAVE_RUBY_ENCODING_H
   default_internal_enc = rb_default_internal_encoding();
   conn_enc = rb_to_encoding(wrapper->encoding);
 #endif
 
-  ptr = wrapper->result;
-  row = (MYSQL_ROW)rb_thread_blocking_region(nogvl_fetch_row, ptr, RUBY_UBF_IO, 0);
-  if (row == NULL) {
-    return Qnil;
+  if (wrapper->fields == Qnil) {
+    wrapper->numberOfFields = mysql_num_fields(wrapper->result);
+    RB_OBJ_WRITE(self, &wrapper->fields, rb_ary_new2(wrapper->numberOfFields));
+  }
+  numberOfValues = wrapper->numberOfFields;
+
+  if (!NIL_P(args->casters)) {
+    if (wrapper->castersFor != args->casters) {
+      mysql2_resolve_casters(self, wrapper, args);
+    }
+    casters = wrapper->casters;
+  }
+
+  if (!NIL_P(args->columns)) {
+    if (wrapper->columnsFor != args->columns || wrapper->columnsSkip != args->skipColumns) {
+      mysql2_resolve_columns(self, wrapper, args);
+    }
+    columns = wrapper->columns;
+    numberOfValues = wrapper->numberOfColumns;
   }
 
-  if (asArray) {
-    rowVal = rb_ary_new2(wrapper->numberOfFields);
+  if (!NIL_P(args->rowClass)) {
+    if (wrapper->rowClass != args->rowClass) {
+      mysql2_resolve_row_class(self, wrapper, args);
+    }
+    // a Struct takes its members, other classes the fields left by :columns
+    if (wrapper->rowMembers) {
+      numberOfValues = wrapper->rowArity;
+    }
+    values = ALLOCA_N(VALUE, numberOfValues + 1);
+  } else if (args->asArray) {
+    rowVal = rb_ary_new2(numberOfValues);
   } else {
     rowVal = rb_hash_new();
   }
-  fieldLengths = mysql_fetch_lengths(wrapper->result);
-  if (wrapper->fields == Qnil) {
-    wrapper->numberOfFields = mysql_num_fields(wrapper->result);
-    wrapper->fields = rb_ary_new2(wrapper->numberOfFields);
-  }
 
-  for (i = 0; i < wrapper->numberOfFields; i++) {
-    VALUE field = rb_mysql_result_fetch_field(self, i, symbolizeKeys);
+  for (k = 0; k < numberOfValues; k++) {
+    VALUE val = Qnil;
+
+    if (values && wrapper->rowMembers) {
+      if (wrapper->rowMembers[k] < 0) {
+        values[k] = Qnil;
+        continue;
+      }
+      i = wrapper->rowMembers[k];
+    } else if (columns) {
+      i = columns[k];
+    } else {
+      i = k;
+    }
+
     if (row[i]) {
-      VALUE val = Qnil;
       enum enum_field_types type = fields[i].type;
 
-      if(!cast) {
+      if (casters && casters[i] != MYSQL2_CASTER_NONE) {
+        VALUE str = Qnil;
+        if (casters[i] == MYSQL2_CASTER_STRING || casters[i] == MYSQL2_CASTER_JSON ||
+            casters[i] == MYSQL2_CASTER_UUID || casters[i] == MYSQL2_CASTER_CALL) {
+          str = rb_str_new(row[i], fieldLengths[i]);
+#ifdef HAVE_RUBY_ENCODING_H
+          str = mysql2_set_field_string_encoding(str, fields[i], default_internal_enc, conn_enc);
+#endif
+        }
+        val = mysql2_apply_caster(wrapper, i, row[i], fieldLengths[i], &fields[i], str);
+      } else if (cells && cells[i].kind != MYSQL2_CELL_RAW) {
+        val = mysql2_box_cell(args, &cells[i], row[i]);
+      } else if(!args->cast) {
         if (type == MYSQL_TYPE_NULL) {
           val = Qnil;
         } else {
-          val = rb_str_new(row[i], fieldLengths[i]);
+          if (args->intern && args->intern[i]) {
+            val = mysql2_intern_lookup(wrapper, i, row[i], fieldLengths[i]);
+          }
+          if (NIL_P(val)) {
+            val = rb_str_new(row[i], fieldLengths[i]);
 #ifdef HAVE_RUBY_ENCODING_H
-          val = mysql2_set_field_string_encoding(val, fields[i], default_internal_enc, conn_enc);
+            val = mysql2_set_field_string_encoding(val, fields[i], default_internal_enc, conn_enc);
 #endif
+            if (args->intern && args->intern[i]) {
+              val = mysql2_intern_store(self, wrapper, i, row[i], fieldLengths[i], val);
+            }
+          }
         }
       } else {
         switch(type) {
@@ -222,7 +952,7 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, ID db_timezone, ID app_timezo
           val = rb_str_new(row[i], fieldLengths[i]);
           break;
         case MYSQL_TYPE_TINY:       // TINYINT field
-          if (castBool && fields[i].length == 1) {
+          if (args->castBool && fields[i].length == 1) {
             val = *row[i] != '0' ? Qtrue : Qfalse;
             break;
           }
@@ -237,10 +967,8 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, ID db_timezone, ID app_timezo
         case MYSQL_TYPE_NEWDECIMAL: // Precision math DECIMAL or NUMERIC field (MySQL 5.0.3 and up)
           if (fields[i].decimals == 0) {
             val = rb_cstr2inum(row[i], 10);
-          } else if (strtod(row[i], NULL) == 0.000000){
-            val = rb_funcall(cBigDecimal, intern_new, 1, opt_decimal_zero);
-          }else{
-            val = rb_funcall(cBigDecimal, intern_new, 1, rb_str_new(row[i], fieldLengths[i]));
+          } else {
+            val = mysql2_cast_decimal(row[i], fieldLengths[i], fields[i].decimals, args->decimalAs);
           }
           break;
         case MYSQL_TYPE_FLOAT:      // FLOAT field
@@ -257,9 +985,9 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, ID db_timezone, ID app_timezo
         case MYSQL_TYPE_TIME: {     // TIME field
           int hour, min, sec, tokens;
           tokens = sscanf(row[i], "%2d:%2d:%2d", &hour, &min, &sec);
-          val = rb_funcall(rb_cTime, db_timezone, 6, opt_time_year, opt_time_month, opt_time_month, INT2NUM(hour), INT2NUM(min), INT2NUM(sec));
-          if (!NIL_P(app_timezone)) {
-            if (app_timezone == intern_local) {
+          val = rb_funcall(rb_cTime, args->db_timezone, 6, opt_time_year, opt_time_month, opt_time_month, INT2NUM(hour), INT2NUM(min), INT2NUM(sec));
+          if (!NIL_P(args->app_timezone)) {
+            if (args->app_timezone == intern_local) {
               val = rb_funcall(val, intern_localtime, 0);
             } else { // utc
               val = rb_funcall(val, intern_utc, 0);
@@ -270,60 +998,16 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, ID db_timezone, ID app_timezo
         case MYSQL_TYPE_TIMESTAMP:  // TIMESTAMP field
         case MYSQL_TYPE_DATETIME: { // DATETIME field
           unsigned int year, month, day, hour, min, sec, tokens;
-          uint64_t seconds;
 
           tokens = sscanf(row[i], "%4d-%2d-%2d %2d:%2d:%2d", &year, &month, &day, &hour, &min, &sec);
-          seconds = (year*31557600ULL) + (month*2592000ULL) + (day*86400ULL) + (hour*3600ULL) + (min*60ULL) + sec;
-
-          if (seconds == 0) {
-            val = Qnil;
-          } else {
-            if (month < 1 || day < 1) {
-              rb_raise(cMysql2Error, "Invalid date: %s", row[i]);
-              val = Qnil;
-            } else {
-              if (seconds < MYSQL2_MIN_TIME || seconds > MYSQL2_MAX_TIME) { // use DateTime instead
-                VALUE offset = INT2NUM(0);
-                if (db_timezone == intern_local) {
-                  offset = rb_funcall(cMysql2Client, intern_local_offset, 0);
-                }
-                val = rb_funcall(cDateTime, intern_civil, 7, INT2NUM(year), INT2NUM(month), INT2NUM(day), INT2NUM(hour), INT2NUM(min), INT2NUM(sec), offset);
-                if (!NIL_P(app_timezone)) {
-                  if (app_timezone == intern_local) {
-                    offset = rb_funcall(cMysql2Client, intern_local_offset, 0);
-                    val = rb_funcall(val, intern_new_offset, 1, offset);
-                  } else { // utc
-                    val = rb_funcall(val, intern_new_offset, 1, opt_utc_offset);
-                  }
-                }
-              } else {
-                val = rb_funcall(rb_cTime, db_timezone, 6, INT2NUM(year), INT2NUM(month), INT2NUM(day), INT2NUM(hour), INT2NUM(min), INT2NUM(sec));
-                if (!NIL_P(app_timezone)) {
-                  if (app_timezone == intern_local) {
-                    val = rb_funcall(val, intern_localtime, 0);
-                  } else { // utc
-                    val = rb_funcall(val, intern_utc, 0);
-                  }
-                }
-              }
-            }
-          }
+          val = mysql2_build_datetime(args, year, month, day, hour, min, sec, row[i]);
           break;
         }
         case MYSQL_TYPE_DATE:       // DATE field
         case MYSQL_TYPE_NEWDATE: {  // Newer const used > 5.0
           int year, month, day, tokens;
           tokens = sscanf(row[i], "%4d-%2d-%2d", &year, &month, &day);
-          if (year+month+day == 0) {
-            val = Qnil;
-          } else {
-            if (month < 1 || day < 1) {
-              rb_raise(cMysql2Error, "Invalid date: %s", row[i]);
-              val = Qnil;
-            } else {
-              val = rb_funcall(cDate, intern_new, 3, INT2NUM(year), INT2NUM(month), INT2NUM(day));
-            }
-          }
+          val = mysql2_build_date(year, month, day, row[i]);
           break;
         }
         case MYSQL_TYPE_TINY_BLOB:
@@ -337,29 +1021,935 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, ID db_timezone, ID app_timezo
         case MYSQL_TYPE_ENUM:       // ENUM field
         case MYSQL_TYPE_GEOMETRY:   // Spatial fielda
         default:
+          if (args->intern && args->intern[i]) {
+            val = mysql2_intern_lookup(wrapper, i, row[i], fieldLengths[i]);
+            if (!NIL_P(val)) {
+              break;
+            }
+          }
           val = rb_str_new(row[i], fieldLengths[i]);
 #ifdef HAVE_RUBY_ENCODING_H
           val = mysql2_set_field_string_encoding(val, fields[i], default_internal_enc, conn_enc);
 #endif
+          if (args->intern && args->intern[i]) {
+            val = mysql2_intern_store(self, wrapper, i, row[i], fieldLengths[i], val);
+          }
           break;
         }
       }
-      if (asArray) {
-        rb_ary_push(rowVal, val);
-      } else {
-        rb_hash_aset(rowVal, field, val);
+      if (args->freezeStrings && TYPE(val) == T_STRING) {
+        OBJ_FREEZE(val);
       }
+    }
+
+    if (values) {
+      values[k] = val;
+    } else if (args->asArray) {
+      rb_ary_push(rowVal, val);
     } else {
-      if (asArray) {
-        rb_ary_push(rowVal, Qnil);
-      } else {
-        rb_hash_aset(rowVal, field, Qnil);
-      }
+      rb_hash_aset(rowVal, rb_mysql_result_fetch_field(self, i, args->symbolizeKeys), val);
     }
   }
+
+  if (values) {
+    rowVal = rb_class_new_instance(numberOfValues, values, args->rowClass);
+  }
   return rowVal;
 }
 
+/*
+ * a cached MYSQL_RES is shared by every Result reading it, so each keeps its
+ * own cursor and the lengths are copied out before casting can run Ruby code
+ * that lets another of them move the MYSQL_RES along
+ */
+static VALUE rb_mysql_result_fetch_cached_row(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args) {
+  unsigned int numberOfFields = mysql_num_fields(wrapper->result);
+  unsigned long *lengths;
+  MYSQL_ROW row;
+
+  mysql_row_seek(wrapper->result, wrapper->cacheCursor);
+  row = mysql_fetch_row(wrapper->result);
+  if (row == NULL) {
+    return Qnil;
+  }
+  wrapper->cacheCursor = mysql_row_tell(wrapper->result);
+
+  lengths = ALLOCA_N(unsigned long, numberOfFields);
+  MEMCPY(lengths, mysql_fetch_lengths(wrapper->result), unsigned long, numberOfFields);
+  return rb_mysql_result_build_row(self, wrapper, args, row, lengths, NULL);
+}
+
+/* moves the cursor #each reads with to row +i+ of a stored result */
+static void rb_mysql_result_seek(mysql2_result_wrapper * wrapper, unsigned long i) {
+  mysql_data_seek(wrapper->result, i);
+  if (wrapper->cacheEntry) {
+    wrapper->cacheCursor = mysql_row_tell(wrapper->result);
+  }
+}
+
+/* the open connection a streamed result reads from, NULL for stored rows or a closed client */
+static MYSQL * rb_mysql_result_connection(mysql2_result_wrapper * wrapper) {
+  mysql_client_wrapper * client;
+
+  if (NIL_P(wrapper->client)) {
+    return NULL;
+  }
+  client = DATA_PTR(wrapper->client);
+  if (client->closed) {
+    return NULL;
+  }
+  return client->client;
+}
+
+/*
+ * unblock function for reads off a streamed result's connection, which is
+ * looked up when it's called since the client may have been closed since
+ */
+static void rb_mysql_result_unblock(void * ptr) {
+  mysql2_result_wrapper * wrapper = ptr;
+  MYSQL *mysql = rb_mysql_result_connection(wrapper);
+
+  if (mysql && ((mysql_client_wrapper *)DATA_PTR(wrapper->client))->shutdown_on_interrupt) {
+    rb_mysql_client_unblock(mysql);
+  }
+}
+
+/* like MYSQL2_CLIENT_UBF, for the client a streamed result reads from */
+static rb_unblock_function_t * rb_mysql_result_ubf(mysql2_result_wrapper * wrapper) {
+  if (NIL_P(wrapper->client) || !((mysql_client_wrapper *)DATA_PTR(wrapper->client))->shutdown_on_interrupt) {
+    return RUBY_UBF_IO;
+  }
+  return rb_mysql_result_unblock;
+}
+
+static VALUE rb_mysql_result_fetch_row(VALUE self, const result_each_args * args) {
+  mysql2_result_wrapper * wrapper;
+  MYSQL_ROW row;
+  void * ptr;
+  GetMysql2Result(self, wrapper);
+
+  if (wrapper->cacheEntry) {
+    return rb_mysql_result_fetch_cached_row(self, wrapper, args);
+  }
+
+  ptr = wrapper->result;
+  row = (MYSQL_ROW)rb_thread_blocking_region(nogvl_fetch_row, ptr, rb_mysql_result_ubf(wrapper), wrapper);
+  if (row == NULL) {
+    return Qnil;
+  }
+
+  return rb_mysql_result_build_row(self, wrapper, args, row, mysql_fetch_lengths(wrapper->result), NULL);
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * which kind of cell each field can be decoded into without the GVL, this
+ * has to agree with the casting rules in rb_mysql_result_build_row
+ */
+static void mysql2_decode_plan(const result_each_args * args, unsigned int numberOfFields, char *plan) {
+  unsigned int i;
+
+  for (i = 0; i < numberOfFields; i++) {
+    switch (args->fields[i].type) {
+    case MYSQL_TYPE_TINY:
+      plan[i] = (args->castBool && args->fields[i].length == 1) ? MYSQL2_CELL_RAW : MYSQL2_CELL_INT;
+      break;
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_YEAR:
+      plan[i] = MYSQL2_CELL_INT;
+      break;
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+      plan[i] = MYSQL2_CELL_DOUBLE;
+      break;
+    case MYSQL_TYPE_TIMESTAMP:
+    case MYSQL_TYPE_DATETIME:
+      plan[i] = MYSQL2_CELL_DATETIME;
+      break;
+    case MYSQL_TYPE_DATE:
+    case MYSQL_TYPE_NEWDATE:
+      plan[i] = MYSQL2_CELL_DATE;
+      break;
+    default:
+      plan[i] = MYSQL2_CELL_RAW;
+      break;
+    }
+  }
+}
+
+/* runs without the GVL, so no Ruby API in here */
+static void mysql2_decode_cell(char plan, const char *str, mysql2_cell *cell) {
+  cell->kind = MYSQL2_CELL_RAW;
+  if (str == NULL) {
+    return;
+  }
+
+  switch (plan) {
+  case MYSQL2_CELL_INT: {
+    char *end;
+    long long num;
+
+    errno = 0;
+    num = strtoll(str, &end, 10);
+    // unsigned BIGINTs past INT64_MAX are left for rb_cstr2inum
+    if (errno == 0 && end != str) {
+      cell->v.i = num;
+      cell->kind = MYSQL2_CELL_INT;
+    }
+    break;
+  }
+  case MYSQL2_CELL_DOUBLE:
+    cell->v.d = strtod(str, NULL);
+    cell->kind = MYSQL2_CELL_DOUBLE;
+    break;
+  case MYSQL2_CELL_DATETIME:
+    memset(&cell->v.t, 0, sizeof(cell->v.t));
+    sscanf(str, "%4u-%2u-%2u %2u:%2u:%2u", &cell->v.t.year, &cell->v.t.month, &cell->v.t.day,
+           &cell->v.t.hour, &cell->v.t.min, &cell->v.t.sec);
+    cell->kind = MYSQL2_CELL_DATETIME;
+    break;
+  case MYSQL2_CELL_DATE:
+    memset(&cell->v.t, 0, sizeof(cell->v.t));
+    sscanf(str, "%4u-%2u-%2u", &cell->v.t.year, &cell->v.t.month, &cell->v.t.day);
+    cell->kind = MYSQL2_CELL_DATE;
+    break;
+  }
+}
+
+typedef struct {
+  MYSQL_RES *result;
+  unsigned int numberOfFields;
+  int threads;
+  char *plan;
+  unsigned long capacity;
+  unsigned long numberOfRows; /* rows in the current batch */
+  MYSQL_ROW *rows;
+  unsigned long *lengths;
+  mysql2_cell *cells;
+} mysql2_decode_batch;
+
+typedef struct {
+  mysql2_decode_batch *batch;
+  unsigned long start, end;
+} mysql2_decode_slice;
+
+static void *mysql2_decode_rows(void *ptr) {
+  mysql2_decode_slice *slice = ptr;
+  mysql2_decode_batch *batch = slice->batch;
+  unsigned long r;
+  unsigned int i;
+
+  for (r = slice->start; r < slice->end; r++) {
+    mysql2_cell *cells = &batch->cells[r * batch->numberOfFields];
+    for (i = 0; i < batch->numberOfFields; i++) {
+      mysql2_decode_cell(batch->plan[i], batch->rows[r][i], &cells[i]);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Read the next batch of rows off a stored result (which is already in
+ * memory) and decode them across batch->threads threads.
+ */
+static VALUE nogvl_decode_batch(void *ptr) {
+  mysql2_decode_batch *batch = ptr;
+  mysql2_decode_slice slices[MYSQL2_MAX_DECODE_THREADS];
+  pthread_t tids[MYSQL2_MAX_DECODE_THREADS];
+  char started[MYSQL2_MAX_DECODE_THREADS];
+  unsigned long n, perThread;
+  int t, threads;
+
+  for (n = 0; n < batch->capacity; n++) {
+    MYSQL_ROW row = mysql_fetch_row(batch->result);
+    if (row == NULL) {
+      break;
+    }
+    batch->rows[n] = row;
+    memcpy(&batch->lengths[n * batch->numberOfFields], mysql_fetch_lengths(batch->result),
+           batch->numberOfFields * sizeof(unsigned long));
+  }
+  batch->numberOfRows = n;
+
+  // don't bother spinning up threads for a handful of rows
+  threads = batch->threads;
+  if (n < (unsigned long)threads * MYSQL2_DECODE_MIN_ROWS_PER_THREAD) {
+    threads = n / MYSQL2_DECODE_MIN_ROWS_PER_THREAD + 1;
+  }
+  perThread = (n + threads - 1) / threads;
+
+  for (t = 0; t < threads; t++) {
+    slices[t].batch = batch;
+    slices[t].start = t * perThread < n ? t * perThread : n;
+    slices[t].end = (t + 1) * perThread < n ? (t + 1) * perThread : n;
+    started[t] = 0;
+  }
+  for (t = 1; t < threads; t++) {
+    started[t] = pthread_create(&tids[t], NULL, mysql2_decode_rows, &slices[t]) == 0;
+  }
+  mysql2_decode_rows(&slices[0]);
+  for (t = 1; t < threads; t++) {
+    if (started[t]) {
+      pthread_join(tids[t], NULL);
+    } else {
+      // couldn't get a thread, do the work ourselves
+      mysql2_decode_rows(&slices[t]);
+    }
+  }
+
+  return Qnil;
+}
+
+typedef struct {
+  VALUE self;
+  VALUE block;
+  mysql2_result_wrapper *wrapper;
+  const result_each_args *args;
+  int cacheRows;
+  mysql2_decode_batch batch;
+} mysql2_decode_each_args;
+
+static VALUE rb_mysql_result_each_decoded(VALUE ptr) {
+  mysql2_decode_each_args *each = (mysql2_decode_each_args *)ptr;
+  mysql2_result_wrapper *wrapper = each->wrapper;
+  mysql2_decode_batch *batch = &each->batch;
+  unsigned long i, r;
+
+  if (each->cacheRows) {
+    unsigned long rowsProcessed = RARRAY_LEN(wrapper->rows);
+    for (i = 0; i < rowsProcessed && each->block != Qnil; i++) {
+      rb_yield(rb_ary_entry(wrapper->rows, i));
+    }
+  }
+
+  while (wrapper->lastRowProcessed < wrapper->numberOfRows) {
+    rb_thread_blocking_region(nogvl_decode_batch, batch, RUBY_UBF_IO, 0);
+    if (batch->numberOfRows == 0) {
+      break;
+    }
+
+    for (r = 0; r < batch->numberOfRows; r++) {
+      unsigned long offset = r * batch->numberOfFields;
+      VALUE row = rb_mysql_result_build_row(each->self, wrapper, each->args, batch->rows[r],
+                                            &batch->lengths[offset], &batch->cells[offset]);
+      if (each->cacheRows) {
+        rb_ary_store(wrapper->rows, wrapper->lastRowProcessed, row);
+      }
+      wrapper->lastRowProcessed++;
+
+      if (each->block != Qnil) {
+        rb_yield(row);
+      }
+    }
+  }
+
+  if (wrapper->lastRowProcessed == wrapper->numberOfRows) {
+    // we don't need the mysql C dataset around anymore, peace it
+    rb_mysql_result_free_result(wrapper);
+  }
+  return wrapper->rows;
+}
+
+static VALUE rb_mysql_result_each_decoded_ensure(VALUE ptr) {
+  mysql2_decode_each_args *each = (mysql2_decode_each_args *)ptr;
+  mysql2_result_wrapper *wrapper = each->wrapper;
+
+  // if the block broke out mid-batch, rewind to the first row the caller
+  // hasn't seen so the next #each picks up from there
+  if (!wrapper->resultFreed && wrapper->lastRowProcessed < wrapper->numberOfRows) {
+    mysql_data_seek(wrapper->result, wrapper->lastRowProcessed);
+  }
+
+  xfree(each->batch.plan);
+  xfree(each->batch.rows);
+  xfree(each->batch.lengths);
+  xfree(each->batch.cells);
+  return Qnil;
+}
+
+static VALUE rb_mysql_result_each_parallel(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args,
+                                           int threads, int cacheRows, VALUE block) {
+  mysql2_decode_each_args each;
+  unsigned int numberOfFields = mysql_num_fields(wrapper->result);
+
+  each.self = self;
+  each.block = block;
+  each.wrapper = wrapper;
+  each.args = args;
+  each.cacheRows = cacheRows;
+
+  each.batch.result = wrapper->result;
+  each.batch.numberOfFields = numberOfFields;
+  each.batch.threads = threads;
+  each.batch.capacity = MYSQL2_DECODE_BATCH_ROWS;
+  each.batch.numberOfRows = 0;
+  each.batch.plan = xmalloc(numberOfFields);
+  each.batch.rows = ALLOC_N(MYSQL_ROW, each.batch.capacity);
+  each.batch.lengths = ALLOC_N(unsigned long, each.batch.capacity * numberOfFields);
+  each.batch.cells = ALLOC_N(mysql2_cell, each.batch.capacity * numberOfFields);
+  mysql2_decode_plan(args, numberOfFields, each.batch.plan);
+
+  return rb_ensure(rb_mysql_result_each_decoded, (VALUE)&each, rb_mysql_result_each_decoded_ensure, (VALUE)&each);
+}
+
+/*
+ * :prefetch reads a streamed result on a thread of its own. It copies each
+ * row out of libmysql's network buffer, which the next mysql_fetch_row
+ * overwrites, into a ring of slots and decodes the numeric and date fields
+ * there, so the socket keeps being read while the block works on earlier rows.
+ */
+typedef struct {
+  char *data;             /* the row's fields, each NUL terminated */
+  size_t capacity;
+  char **fields;          /* into data, NULL for NULL fields */
+  unsigned long *lengths;
+  mysql2_cell *cells;
+} mysql2_prefetch_slot;
+
+struct mysql2_prefetch {
+  MYSQL_RES *result;
+  unsigned int numberOfFields;
+  char *plan;
+  int castBool;           /* the :cast_booleans the plan was made for */
+  mysql2_prefetch_slot *slots;
+  unsigned long size;
+  unsigned long head;     /* the oldest filled slot */
+  unsigned long count;    /* filled slots */
+  char eof;               /* the reader is done, at the end of the rows or out of memory */
+  char failed;
+  char stop;
+  char woken;             /* the Ruby thread waiting for a row has an interrupt */
+  char running;           /* a reader thread was started and hasn't been joined */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+/* runs without the GVL, so no Ruby API in here */
+static int mysql2_prefetch_copy(struct mysql2_prefetch *p, mysql2_prefetch_slot *slot, MYSQL_ROW row) {
+  unsigned long *lengths = mysql_fetch_lengths(p->result);
+  size_t size = 0, offset = 0;
+  unsigned int i;
+
+  for (i = 0; i < p->numberOfFields; i++) {
+    size += lengths[i] + 1;
+  }
+  if (size > slot->capacity) {
+    char *data = realloc(slot->data, size);
+    if (data == NULL) {
+      return 0;
+    }
+    slot->data = data;
+    slot->capacity = size;
+  }
+
+  for (i = 0; i < p->numberOfFields; i++) {
+    slot->lengths[i] = lengths[i];
+    if (row[i] == NULL) {
+      slot->fields[i] = NULL;
+    } else {
+      slot->fields[i] = slot->data + offset;
+      memcpy(slot->fields[i], row[i], lengths[i]);
+      slot->fields[i][lengths[i]] = '\0';
+      offset += lengths[i] + 1;
+    }
+    mysql2_decode_cell(p->plan[i], slot->fields[i], &slot->cells[i]);
+  }
+  return 1;
+}
+
+static void *mysql2_prefetch_read(void *ptr) {
+  struct mysql2_prefetch *p = ptr;
+
+  // libmysql keeps per-thread state that every thread calling it has to set up and free
+  if (mysql_thread_init()) {
+    pthread_mutex_lock(&p->lock);
+    p->eof = 1;
+    p->failed = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&p->lock);
+  while (!p->stop && !p->eof) {
+    mysql2_prefetch_slot *slot;
+    MYSQL_ROW row;
+    int copied = 0;
+
+    if (p->count == p->size) {
+      pthread_cond_wait(&p->changed, &p->lock);
+      continue;
+    }
+    // the Ruby thread only touches slots from head to head + count
+    slot = &p->slots[(p->head + p->count) % p->size];
+    pthread_mutex_unlock(&p->lock);
+
+    row = mysql_fetch_row(p->result);
+    if (row != NULL) {
+      copied = mysql2_prefetch_copy(p, slot, row);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    if (copied) {
+      p->count++;
+    } else {
+      p->eof = 1;
+      p->failed = row != NULL;
+    }
+    pthread_cond_broadcast(&p->changed);
+  }
+  pthread_mutex_unlock(&p->lock);
+  mysql_thread_end();
+  return NULL;
+}
+
+static VALUE nogvl_prefetch_wait(void *ptr) {
+  struct mysql2_prefetch *p = ptr;
+
+  pthread_mutex_lock(&p->lock);
+  while (p->count == 0 && !p->eof && !p->woken) {
+    pthread_cond_wait(&p->changed, &p->lock);
+  }
+  p->woken = 0;
+  pthread_mutex_unlock(&p->lock);
+  return Qnil;
+}
+
+static void mysql2_prefetch_wake(void *ptr) {
+  struct mysql2_prefetch *p = ptr;
+
+  pthread_mutex_lock(&p->lock);
+  p->woken = 1;
+  pthread_cond_broadcast(&p->changed);
+  pthread_mutex_unlock(&p->lock);
+}
+
+static VALUE nogvl_prefetch_join(void *ptr) {
+  struct mysql2_prefetch *p = ptr;
+
+  pthread_join(p->thread, NULL);
+  p->running = 0;
+  return Qnil;
+}
+
+static void rb_mysql_result_start_prefetch(mysql2_result_wrapper * wrapper, const result_each_args * args, unsigned long size) {
+  struct mysql2_prefetch *p = wrapper->prefetch;
+  unsigned long i;
+
+  if (p == NULL) {
+    p = ALLOC(struct mysql2_prefetch);
+    MEMZERO(p, struct mysql2_prefetch, 1);
+    p->result = wrapper->result;
+    p->numberOfFields = mysql_num_fields(wrapper->result);
+    p->plan = xmalloc(p->numberOfFields);
+    mysql2_decode_plan(args, p->numberOfFields, p->plan);
+    p->castBool = args->castBool;
+    p->size = size;
+    p->slots = ALLOC_N(mysql2_prefetch_slot, size);
+    MEMZERO(p->slots, mysql2_prefetch_slot, size);
+    for (i = 0; i < size; i++) {
+      p->slots[i].fields = ALLOC_N(char *, p->numberOfFields);
+      p->slots[i].lengths = ALLOC_N(unsigned long, p->numberOfFields);
+      p->slots[i].cells = ALLOC_N(mysql2_cell, p->numberOfFields);
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    wrapper->prefetch = p;
+  }
+
+  if (!p->eof && !p->running) {
+    p->stop = 0;
+    // without a thread, rows are read the usual way once the slots are used up
+    p->running = pthread_create(&p->thread, NULL, mysql2_prefetch_read, p) == 0;
+  }
+}
+
+/* the reader is stopped before #each returns, it must not use the connection after that */
+static VALUE rb_mysql_result_stop_prefetch(VALUE ptr) {
+  mysql2_result_wrapper * wrapper = (mysql2_result_wrapper *)ptr;
+  struct mysql2_prefetch *p = wrapper->prefetch;
+
+  if (p == NULL || !p->running) {
+    return Qnil;
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_broadcast(&p->changed);
+  pthread_mutex_unlock(&p->lock);
+
+  // the reader finishes the row it's reading first, a Thread#kill while
+  // that takes long shuts the socket down
+  rb_thread_blocking_region(nogvl_prefetch_join, p, rb_mysql_result_ubf(wrapper), wrapper);
+  if (p->running) {
+    // an interrupt kept the join from running at all
+    rb_mysql_result_unblock(wrapper);
+    pthread_join(p->thread, NULL);
+    p->running = 0;
+  }
+  return Qnil;
+}
+
+static void rb_mysql_result_free_prefetch(mysql2_result_wrapper * wrapper) {
+  struct mysql2_prefetch *p = wrapper->prefetch;
+  unsigned long i;
+
+  if (p == NULL) {
+    return;
+  }
+  rb_mysql_result_stop_prefetch((VALUE)wrapper);
+
+  for (i = 0; i < p->size; i++) {
+    free(p->slots[i].data);
+    xfree(p->slots[i].fields);
+    xfree(p->slots[i].lengths);
+    xfree(p->slots[i].cells);
+  }
+  xfree(p->slots);
+  xfree(p->plan);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->changed);
+  xfree(p);
+  wrapper->prefetch = NULL;
+}
+
+static VALUE rb_mysql_result_fetch_prefetched_row(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args) {
+  struct mysql2_prefetch *p = wrapper->prefetch;
+  mysql2_prefetch_slot *slot;
+  unsigned long count;
+  char eof;
+  VALUE row;
+
+  for (;;) {
+    pthread_mutex_lock(&p->lock);
+    count = p->count;
+    eof = p->eof;
+    pthread_mutex_unlock(&p->lock);
+
+    if (count > 0) {
+      break;
+    }
+    if (eof) {
+      if (p->failed) {
+        rb_memerror();
+      }
+      return Qnil;
+    }
+    if (!p->running) {
+      return rb_mysql_result_fetch_row(self, args);
+    }
+    rb_thread_blocking_region(nogvl_prefetch_wait, p, mysql2_prefetch_wake, p);
+  }
+
+  slot = &p->slots[p->head];
+  row = rb_mysql_result_build_row(self, wrapper, args, slot->fields, slot->lengths,
+                                  (args->cast && args->castBool == p->castBool) ? slot->cells : NULL);
+
+  pthread_mutex_lock(&p->lock);
+  p->head = (p->head + 1) % p->size;
+  p->count--;
+  pthread_cond_broadcast(&p->changed);
+  pthread_mutex_unlock(&p->lock);
+  return row;
+}
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+/*
+ * :spill reads a result with mysql_use_result straight into an unlinked
+ * temporary file and maps it, so a result bigger than memory still has a
+ * count, can be iterated again and indexed, while the connection is free as
+ * soon as the query returns. A row is its fields one after the other, each a
+ * 4 byte length (MYSQL2_SPILL_NULL for NULL) followed by the bytes and a NUL,
+ * so rows can be cast straight out of the map like libmysql's own.
+ */
+#define MYSQL2_SPILL_NULL 0xFFFFFFFFU
+/* the offset of every this many rows is kept for seeking */
+#define MYSQL2_SPILL_STRIDE 64
+#define MYSQL2_SPILL_BUFFER (256 * 1024)
+
+struct mysql2_spill {
+  char *map;
+  size_t size;
+  unsigned long numberOfRows;
+  size_t *index;          /* malloc'd, it's filled without the GVL */
+  unsigned long cursor;   /* the row at cursorOffset */
+  size_t cursorOffset;
+};
+
+typedef struct {
+  struct mysql2_spill *spill;
+  MYSQL_RES *result;
+  unsigned int numberOfFields;
+  int fd;
+  int error;              /* errno of the first failure, rows are still read after it */
+  char *buffer;
+  size_t used;
+  size_t flushed;         /* bytes in the file before the buffer */
+  unsigned long indexCapacity;
+} mysql2_spill_writer;
+
+/* runs without the GVL, so no Ruby API in here */
+static void mysql2_spill_flush(mysql2_spill_writer *w) {
+  size_t done = 0;
+
+  while (done < w->used && !w->error) {
+    ssize_t n = write(w->fd, w->buffer + done, w->used - done);
+    if (n < 0) {
+      if (errno != EINTR) {
+        w->error = errno;
+      }
+    } else {
+      done += n;
+    }
+  }
+  w->flushed += w->used;
+  w->used = 0;
+}
+
+static void mysql2_spill_put(mysql2_spill_writer *w, const char *data, size_t len) {
+  while (len > 0 && !w->error) {
+    size_t n = MYSQL2_SPILL_BUFFER - w->used;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(w->buffer + w->used, data, n);
+    w->used += n;
+    data += n;
+    len -= n;
+    if (w->used == MYSQL2_SPILL_BUFFER) {
+      mysql2_spill_flush(w);
+    }
+  }
+}
+
+static VALUE nogvl_spill_rows(void *ptr) {
+  mysql2_spill_writer *w = ptr;
+  struct mysql2_spill *spill = w->spill;
+  MYSQL_ROW row;
+  unsigned int i;
+
+  while ((row = mysql_fetch_row(w->result)) != NULL) {
+    unsigned long *lengths;
+
+    // keep reading so the connection is usable afterwards
+    if (w->error) {
+      continue;
+    }
+
+    if (spill->numberOfRows % MYSQL2_SPILL_STRIDE == 0) {
+      unsigned long slot = spill->numberOfRows / MYSQL2_SPILL_STRIDE;
+      if (slot == w->indexCapacity) {
+        size_t *index = realloc(spill->index, (w->indexCapacity * 2 + 16) * sizeof(size_t));
+        if (index == NULL) {
+          w->error = ENOMEM;
+          continue;
+        }
+        spill->index = index;
+        w->indexCapacity = w->indexCapacity * 2 + 16;
+      }
+      spill->index[slot] = w->flushed + w->used;
+    }
+
+    lengths = mysql_fetch_lengths(w->result);
+    for (i = 0; i < w->numberOfFields; i++) {
+      uint32_t len = row[i] ? (uint32_t)lengths[i] : MYSQL2_SPILL_NULL;
+      mysql2_spill_put(w, (const char *)&len, sizeof(len));
+      if (row[i]) {
+        mysql2_spill_put(w, row[i], lengths[i]);
+        mysql2_spill_put(w, "", 1);
+      }
+    }
+    spill->numberOfRows++;
+  }
+  mysql2_spill_flush(w);
+  return Qnil;
+}
+
+/* reads the row at +offset+ into +row+ and +lengths+ (if given), returns where the next one starts */
+static size_t mysql2_spill_row(struct mysql2_spill *spill, size_t offset, unsigned int numberOfFields, char **row, unsigned long *lengths) {
+  unsigned int i;
+
+  for (i = 0; i < numberOfFields; i++) {
+    uint32_t len;
+    memcpy(&len, spill->map + offset, sizeof(len));
+    offset += sizeof(len);
+    if (row) {
+      row[i] = len == MYSQL2_SPILL_NULL ? NULL : spill->map + offset;
+      lengths[i] = len == MYSQL2_SPILL_NULL ? 0 : len;
+    }
+    if (len != MYSQL2_SPILL_NULL) {
+      offset += len + 1;
+    }
+  }
+  return offset;
+}
+
+static VALUE rb_mysql_result_fetch_spilled_row(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args, unsigned long n) {
+  struct mysql2_spill *spill = wrapper->spill;
+  unsigned int numberOfFields = mysql_num_fields(wrapper->result);
+  char **row;
+  unsigned long *lengths;
+
+  if (n >= spill->numberOfRows) {
+    return Qnil;
+  }
+
+  if (n != spill->cursor) {
+    // walk from the closest indexed row at or before n
+    spill->cursor = n - n % MYSQL2_SPILL_STRIDE;
+    spill->cursorOffset = spill->index[n / MYSQL2_SPILL_STRIDE];
+    while (spill->cursor < n) {
+      spill->cursorOffset = mysql2_spill_row(spill, spill->cursorOffset, numberOfFields, NULL, NULL);
+      spill->cursor++;
+    }
+  }
+
+  row = ALLOCA_N(char *, numberOfFields);
+  lengths = ALLOCA_N(unsigned long, numberOfFields);
+  spill->cursorOffset = mysql2_spill_row(spill, spill->cursorOffset, numberOfFields, row, lengths);
+  spill->cursor++;
+  return rb_mysql_result_build_row(self, wrapper, args, row, lengths, NULL);
+}
+
+/* the file stays mapped until the Result is collected, so it can be read any number of times */
+static VALUE rb_mysql_result_each_spilled(VALUE self, mysql2_result_wrapper * wrapper, const result_each_args * args,
+                                          int cacheRows, VALUE block) {
+  unsigned long i;
+
+  for (i = 0; i < wrapper->numberOfRows; i++) {
+    VALUE row = Qnil;
+    if (cacheRows && i < (unsigned long)RARRAY_LEN(wrapper->rows)) {
+      row = rb_ary_entry(wrapper->rows, i);
+    }
+    if (row == Qnil) {
+      row = rb_mysql_result_fetch_spilled_row(self, wrapper, args, i);
+      if (cacheRows) {
+        rb_ary_store(wrapper->rows, i, row);
+      }
+    }
+    if (i >= wrapper->lastRowProcessed) {
+      wrapper->lastRowProcessed = i + 1;
+    }
+
+    if (block != Qnil) {
+      rb_yield(row);
+    }
+  }
+  return wrapper->rows;
+}
+
+static void rb_mysql_result_free_spill(mysql2_result_wrapper * wrapper) {
+  struct mysql2_spill *spill = wrapper->spill;
+
+  if (spill == NULL) {
+    return;
+  }
+  if (spill->map) {
+    munmap(spill->map, spill->size);
+  }
+  free(spill->index);
+  xfree(spill);
+  wrapper->spill = NULL;
+}
+
+/*
+ * Reads every row of a mysql_use_result result into a temporary file in
+ * +dir+ (nil for $TMPDIR or /tmp) and maps it. The connection is free
+ * afterwards, even when this raises.
+ */
+void rb_mysql_result_spill(VALUE self, VALUE dir) {
+  mysql2_result_wrapper * wrapper;
+  mysql2_spill_writer w;
+  MYSQL *mysql;
+  VALUE path;
+
+  GetMysql2Result(self, wrapper);
+
+  if (NIL_P(dir)) {
+    const char *tmpdir = getenv("TMPDIR");
+    dir = rb_str_new2(tmpdir && *tmpdir ? tmpdir : "/tmp");
+  }
+  path = rb_str_dup(StringValue(dir));
+  rb_str_cat2(path, "/mysql2-spill-XXXXXX");
+
+  wrapper->spill = ALLOC(struct mysql2_spill);
+  MEMZERO(wrapper->spill, struct mysql2_spill, 1);
+  w.spill = wrapper->spill;
+  w.result = wrapper->result;
+  w.numberOfFields = mysql_num_fields(wrapper->result);
+  w.error = 0;
+  w.used = 0;
+  w.flushed = 0;
+  w.indexCapacity = 0;
+  w.fd = mkstemp(RSTRING_PTR(path));
+  if (w.fd < 0) {
+    w.error = errno;
+  } else {
+    // nothing else needs to find it, and it's gone once it's unmapped
+    unlink(RSTRING_PTR(path));
+  }
+  w.buffer = xmalloc(MYSQL2_SPILL_BUFFER);
+
+  rb_thread_blocking_region(nogvl_spill_rows, &w, rb_mysql_result_ubf(wrapper), wrapper);
+  xfree(w.buffer);
+
+  if (!w.error && w.flushed > 0) {
+    void *map = mmap(NULL, w.flushed, PROT_READ, MAP_PRIVATE, w.fd, 0);
+    if (map == MAP_FAILED) {
+      w.error = errno;
+    } else {
+      wrapper->spill->map = map;
+      wrapper->spill->size = w.flushed;
+    }
+  }
+  if (w.fd >= 0) {
+    close(w.fd);
+  }
+
+  mysql = rb_mysql_result_connection(wrapper);
+  if (mysql && mysql_errno(mysql)) {
+    rb_raise_mysql2_error(DATA_PTR(wrapper->client));
+  }
+  if (w.error) {
+    wrapper->spill->numberOfRows = 0;
+    errno = w.error;
+    rb_sys_fail("spilling a result to disk");
+  }
+}
+#endif
+
+typedef struct {
+  VALUE self;
+  VALUE block;
+  mysql2_result_wrapper *wrapper;
+  const result_each_args *args;
+} mysql2_stream_args;
+
+static VALUE rb_mysql_result_stream_rows(VALUE ptr) {
+  mysql2_stream_args *stream = (mysql2_stream_args *)ptr;
+  VALUE row;
+
+  do {
+#ifdef HAVE_PTHREAD_H
+    if (stream->wrapper->prefetch) {
+      row = rb_mysql_result_fetch_prefetched_row(stream->self, stream->wrapper, stream->args);
+    } else
+#endif
+    row = rb_mysql_result_fetch_row(stream->self, stream->args);
+
+    if (stream->block != Qnil && row != Qnil) {
+      rb_yield(row);
+      stream->wrapper->lastRowProcessed++;
+    }
+  } while(row != Qnil);
+  return Qnil;
+}
+
 static VALUE rb_mysql_result_fetch_fields(VALUE self) {
   mysql2_result_wrapper * wrapper;
   unsigned int i = 0;
@@ -375,7 +1965,7 @@ static VALUE rb_mysql_result_fetch_fields(VALUE self) {
 
   if (wrapper->fields == Qnil) {
     wrapper->numberOfFields = mysql_num_fields(wrapper->result);
-    wrapper->fields = rb_ary_new2(wrapper->numberOfFields);
+    RB_OBJ_WRITE(self, &wrapper->fields, rb_ary_new2(wrapper->numberOfFields));
   }
 
   if (RARRAY_LEN(wrapper->fields) != wrapper->numberOfFields) {
@@ -387,70 +1977,147 @@ static VALUE rb_mysql_result_fetch_fields(VALUE self) {
   return wrapper->fields;
 }
 
-static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
-  VALUE defaults, opts, block;
-  ID db_timezone, app_timezone, dbTz, appTz;
-  mysql2_result_wrapper * wrapper;
-  unsigned long i;
-  int symbolizeKeys = 0, asArray = 0, castBool = 0, cacheRows = 1, cast = 1, streaming = 0;
-  MYSQL_FIELD * fields = NULL;
+/* the options deciding how rows are cast, for #each and #[] */
+static void rb_mysql_result_casting_args(VALUE opts, result_each_args * args) {
+  VALUE dbTz, appTz, decimalOpt, asOpt, columnsOpt, castersOpt;
 
-  GetMysql2Result(self, wrapper);
-
-  defaults = rb_iv_get(self, "@query_options");
-  if (rb_scan_args(argc, argv, "01&", &opts, &block) == 1) {
-    opts = rb_funcall(defaults, intern_merge, 1, opts);
-  } else {
-    opts = defaults;
-  }
+  args->symbolizeKeys = 0;
+  args->asArray = 0;
+  args->castBool = 0;
+  args->cast = 1;
+  args->decimalAs = DECIMAL_AS_BIG_DECIMAL;
+  args->fields = NULL;
+  args->intern = NULL;
+  args->freezeStrings = 0;
+  args->rowClass = Qnil;
+  args->columns = Qnil;
+  args->skipColumns = 0;
+  args->casters = Qnil;
 
   if (rb_hash_aref(opts, sym_symbolize_keys) == Qtrue) {
-    symbolizeKeys = 1;
+    args->symbolizeKeys = 1;
   }
 
-  if (rb_hash_aref(opts, sym_as) == sym_array) {
-    asArray = 1;
+  asOpt = rb_hash_aref(opts, sym_as);
+  if (asOpt == sym_array) {
+    args->asArray = 1;
+  } else if (TYPE(asOpt) == T_CLASS) {
+    args->rowClass = asOpt;
   }
 
   if (rb_hash_aref(opts, sym_cast_booleans) == Qtrue) {
-    castBool = 1;
+    args->castBool = 1;
   }
 
-  if (rb_hash_aref(opts, sym_cache_rows) == Qfalse) {
-    cacheRows = 0;
+  if (rb_hash_aref(opts, sym_cast) == Qfalse) {
+    args->cast = 0;
   }
 
-  if (rb_hash_aref(opts, sym_cast) == Qfalse) {
-    cast = 0;
+  decimalOpt = rb_hash_aref(opts, sym_decimal_as);
+  if (decimalOpt == sym_float) {
+    args->decimalAs = DECIMAL_AS_FLOAT;
+  } else if (decimalOpt == sym_rational) {
+    args->decimalAs = DECIMAL_AS_RATIONAL;
+  } else if (decimalOpt == sym_scaled_int) {
+    args->decimalAs = DECIMAL_AS_SCALED_INT;
+  } else if (!NIL_P(decimalOpt) && decimalOpt != sym_big_decimal) {
+    rb_warn(":decimal_as option must be :big_decimal, :float, :rational or :scaled_int - defaulting to :big_decimal");
   }
 
-  if(rb_hash_aref(opts, sym_stream) == Qtrue) {
-    streaming = 1;
+  if (rb_hash_aref(opts, sym_freeze_strings) == Qtrue) {
+    args->freezeStrings = 1;
   }
 
-  if(streaming && cacheRows) {
-    rb_warn("cacheRows is ignored if streaming is true");
+  columnsOpt = rb_hash_aref(opts, sym_columns);
+  if (NIL_P(columnsOpt)) {
+    columnsOpt = rb_hash_aref(opts, sym_skip_columns);
+    args->skipColumns = !NIL_P(columnsOpt);
+  }
+  if (!NIL_P(columnsOpt)) {
+    Check_Type(columnsOpt, T_ARRAY);
+    args->columns = columnsOpt;
+  }
+
+  castersOpt = rb_hash_aref(opts, sym_casters);
+  if (!NIL_P(castersOpt)) {
+    Check_Type(castersOpt, T_HASH);
+    args->casters = castersOpt;
   }
 
   dbTz = rb_hash_aref(opts, sym_database_timezone);
   if (dbTz == sym_local) {
-    db_timezone = intern_local;
+    args->db_timezone = intern_local;
   } else if (dbTz == sym_utc) {
-    db_timezone = intern_utc;
+    args->db_timezone = intern_utc;
   } else {
     if (!NIL_P(dbTz)) {
       rb_warn(":database_timezone option must be :utc or :local - defaulting to :local");
     }
-    db_timezone = intern_local;
+    args->db_timezone = intern_local;
   }
 
   appTz = rb_hash_aref(opts, sym_application_timezone);
   if (appTz == sym_local) {
-    app_timezone = intern_local;
+    args->app_timezone = intern_local;
   } else if (appTz == sym_utc) {
-    app_timezone = intern_utc;
+    args->app_timezone = intern_utc;
+  } else {
+    args->app_timezone = Qnil;
+  }
+}
+
+static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
+  VALUE defaults, opts, block;
+  VALUE internOpt, threadsOpt, prefetchOpt;
+  mysql2_result_wrapper * wrapper;
+  unsigned long i;
+  int cacheRows = 1, streaming = 0, decodeThreads = 1;
+  unsigned long prefetchRows = 0;
+  result_each_args args;
+
+  GetMysql2Result(self, wrapper);
+
+  defaults = rb_iv_get(self, "@query_options");
+  if (rb_scan_args(argc, argv, "01&", &opts, &block) == 1) {
+    opts = rb_funcall(defaults, intern_merge, 1, opts);
   } else {
-    app_timezone = Qnil;
+    opts = defaults;
+  }
+
+  rb_mysql_result_casting_args(opts, &args);
+
+  if (rb_hash_aref(opts, sym_cache_rows) == Qfalse) {
+    cacheRows = 0;
+  }
+
+  if(rb_hash_aref(opts, sym_stream) == Qtrue) {
+    streaming = 1;
+  }
+
+  threadsOpt = rb_hash_aref(opts, sym_decode_threads);
+  if (!NIL_P(threadsOpt)) {
+    decodeThreads = NUM2INT(threadsOpt);
+    if (decodeThreads < 1) {
+      decodeThreads = 1;
+    } else if (decodeThreads > MYSQL2_MAX_DECODE_THREADS) {
+      decodeThreads = MYSQL2_MAX_DECODE_THREADS;
+    }
+  }
+
+  prefetchOpt = rb_hash_aref(opts, sym_prefetch);
+  if (!NIL_P(prefetchOpt) && prefetchOpt != Qfalse && streaming) {
+    prefetchRows = NUM2ULONG(prefetchOpt);
+  }
+
+  internOpt = rb_hash_aref(opts, sym_intern);
+  if (RTEST(internOpt) && !wrapper->resultFreed) {
+    unsigned int numberOfFields = mysql_num_fields(wrapper->result);
+    args.intern = ALLOCA_N(char, numberOfFields);
+    mysql2_intern_fields(mysql_fetch_fields(wrapper->result), numberOfFields, internOpt, args.intern);
+  }
+
+  if(streaming && cacheRows) {
+    rb_warn("cacheRows is ignored if streaming is true");
   }
 
   if (wrapper->lastRowProcessed == 0) {
@@ -458,31 +2125,47 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
       // We can't get number of rows if we're streaming,
       // until we've finished fetching all rows
       wrapper->numberOfRows = 0;
-      wrapper->rows = rb_ary_new();
+      RB_OBJ_WRITE(self, &wrapper->rows, rb_ary_new());
+    } else if (wrapper->resultFreed) {
+      // an empty result, let go of the first time round
+      if (NIL_P(wrapper->rows)) {
+        RB_OBJ_WRITE(self, &wrapper->rows, rb_ary_new());
+      }
+      return wrapper->rows;
     } else {
       wrapper->numberOfRows = mysql_num_rows(wrapper->result);
       if (wrapper->numberOfRows == 0) {
-        wrapper->rows = rb_ary_new();
+        RB_OBJ_WRITE(self, &wrapper->rows, rb_ary_new());
+        // nothing to read, don't wait for the GC to hand the dataset back,
+        // but #fields still needs it
+        rb_mysql_result_fetch_fields(self);
+        rb_mysql_result_free_result(wrapper);
         return wrapper->rows;
       }
-      wrapper->rows = rb_ary_new2(wrapper->numberOfRows);
+      // #[] and #slice may have cached some rows already
+      if (NIL_P(wrapper->rows)) {
+        RB_OBJ_WRITE(self, &wrapper->rows, rb_ary_new2(wrapper->numberOfRows));
+      }
     }
   }
 
   if (streaming) {
     if(!wrapper->streamingComplete) {
-      VALUE row;
-
-      fields = mysql_fetch_fields(wrapper->result);
+      mysql2_stream_args stream;
 
-      do {
-        row = rb_mysql_result_fetch_row(self, db_timezone, app_timezone, symbolizeKeys, asArray, castBool, cast, fields);
+      args.fields = mysql_fetch_fields(wrapper->result);
+      stream.self = self;
+      stream.block = block;
+      stream.wrapper = wrapper;
+      stream.args = &args;
 
-        if (block != Qnil && row != Qnil) {
-          rb_yield(row);
-          wrapper->lastRowProcessed++;
-        }
-      } while(row != Qnil);
+#ifdef HAVE_PTHREAD_H
+      if (prefetchRows > 0) {
+        rb_mysql_result_start_prefetch(wrapper, &args, prefetchRows);
+        rb_ensure(rb_mysql_result_stream_rows, (VALUE)&stream, rb_mysql_result_stop_prefetch, (VALUE)wrapper);
+      } else
+#endif
+      rb_mysql_result_stream_rows((VALUE)&stream);
 
       rb_mysql_result_free_result(wrapper);
 
@@ -501,18 +2184,35 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
     } else {
       unsigned long rowsProcessed = 0;
       rowsProcessed = RARRAY_LEN(wrapper->rows);
-      fields = mysql_fetch_fields(wrapper->result);
+      args.fields = mysql_fetch_fields(wrapper->result);
+
+#ifdef HAVE_SYS_MMAN_H
+      if (wrapper->spill) {
+        return rb_mysql_result_each_spilled(self, wrapper, &args, cacheRows, block);
+      }
+#endif
+
+#ifdef HAVE_PTHREAD_H
+      if (decodeThreads > 1 && args.cast && !wrapper->cacheEntry && rowsProcessed <= wrapper->lastRowProcessed) {
+        return rb_mysql_result_each_parallel(self, wrapper, &args, decodeThreads, cacheRows, block);
+      }
+#endif
 
       for (i = 0; i < wrapper->numberOfRows; i++) {
-        VALUE row;
+        VALUE row = Qnil;
         if (cacheRows && i < rowsProcessed) {
           row = rb_ary_entry(wrapper->rows, i);
-        } else {
-          row = rb_mysql_result_fetch_row(self, db_timezone, app_timezone, symbolizeKeys, asArray, castBool, cast, fields);
+        }
+        if (row == Qnil) {
+          if (cacheRows && i != wrapper->lastRowProcessed) {
+            // skipped over rows #[] or #slice cached ahead of us
+            rb_mysql_result_seek(wrapper, i);
+          }
+          row = rb_mysql_result_fetch_row(self, &args);
           if (cacheRows) {
             rb_ary_store(wrapper->rows, i, row);
           }
-          wrapper->lastRowProcessed++;
+          wrapper->lastRowProcessed = i + 1;
         }
 
         if (row == Qnil) {
@@ -550,39 +2250,264 @@ static VALUE rb_mysql_result_count(VALUE self) {
   }
 }
 
+/*
+ * Rows +offset+ up to +offset+ + +len+, which have to exist. Rows #each has
+ * cached are reused, the others are decoded by seeking a stored result or
+ * the spill file to them, and cached with :cache_rows like #each would. The
+ * cursor #each reads with is left where it was.
+ */
+static VALUE rb_mysql_result_rows_at(VALUE self, mysql2_result_wrapper * wrapper, unsigned long offset, unsigned long len) {
+  result_each_args args;
+  VALUE opts, internOpt, rows;
+  MYSQL_ROW_OFFSET saved = NULL, cursor = NULL;
+  unsigned long *lengths = NULL;
+  unsigned int numberOfFields = 0;
+  unsigned long i;
+  int cacheRows, prepared = 0;
+
+  opts = rb_iv_get(self, "@query_options");
+  cacheRows = rb_hash_aref(opts, sym_cache_rows) != Qfalse;
+  rows = rb_ary_new2(len);
+
+  for (i = offset; i < offset + len; i++) {
+    VALUE row = Qnil;
+    MYSQL_ROW fields;
+
+    if (!NIL_P(wrapper->rows) && i < (unsigned long)RARRAY_LEN(wrapper->rows)) {
+      row = rb_ary_entry(wrapper->rows, i);
+    }
+    if (row != Qnil) {
+      rb_ary_push(rows, row);
+      continue;
+    }
+
+    if (wrapper->resultFreed) {
+      rb_raise(cMysql2Error, "The rows of this result have been freed, keep them with :cache_rows or query again");
+    }
+    if (!prepared) {
+      rb_mysql_result_casting_args(opts, &args);
+      numberOfFields = mysql_num_fields(wrapper->result);
+      args.fields = mysql_fetch_fields(wrapper->result);
+      internOpt = rb_hash_aref(opts, sym_intern);
+      if (RTEST(internOpt)) {
+        args.intern = ALLOCA_N(char, numberOfFields);
+        mysql2_intern_fields(args.fields, numberOfFields, internOpt, args.intern);
+      }
+      lengths = ALLOCA_N(unsigned long, numberOfFields);
+      if (NIL_P(wrapper->rows)) {
+        RB_OBJ_WRITE(self, &wrapper->rows, rb_ary_new());
+      }
+      prepared = 1;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if (wrapper->spill) {
+      row = rb_mysql_result_fetch_spilled_row(self, wrapper, &args, i);
+    } else
+#endif
+    {
+      // mysql_data_seek walks the rows from the first one, so only seek once
+      // and keep our own offset, casting can run code that moves the MYSQL_RES
+      if (cursor == NULL) {
+        saved = mysql_row_tell(wrapper->result);
+        mysql_data_seek(wrapper->result, i);
+      } else {
+        mysql_row_seek(wrapper->result, cursor);
+      }
+      fields = mysql_fetch_row(wrapper->result);
+      cursor = mysql_row_tell(wrapper->result);
+      MEMCPY(lengths, mysql_fetch_lengths(wrapper->result), unsigned long, numberOfFields);
+      mysql_row_seek(wrapper->result, saved);
+
+      row = rb_mysql_result_build_row(self, wrapper, &args, fields, lengths, NULL);
+    }
+
+    if (cacheRows) {
+      rb_ary_store(wrapper->rows, i, row);
+    }
+    rb_ary_push(rows, row);
+  }
+  return rows;
+}
+
+/* the number of rows, #[] and #slice can't know it for a streamed result */
+static long rb_mysql_result_random_access_count(VALUE self) {
+  if (rb_hash_aref(rb_iv_get(self, "@query_options"), sym_stream) == Qtrue) {
+    rb_raise(cMysql2Error, "Rows of a streamed result can only be read in order, with #each");
+  }
+  return NUM2LONG(rb_mysql_result_count(self));
+}
+
+/* call-seq: result[index]
+ *
+ * The row at +index+, counting back from the end when it's negative, or nil
+ * past either end. Only that row is decoded, see #slice.
+ */
+static VALUE rb_mysql_result_aref(VALUE self, VALUE index) {
+  mysql2_result_wrapper * wrapper;
+  long i = NUM2LONG(index);
+  long numberOfRows;
+
+  GetMysql2Result(self, wrapper);
+  numberOfRows = rb_mysql_result_random_access_count(self);
+  if (i < 0) {
+    i += numberOfRows;
+  }
+  if (i < 0 || i >= numberOfRows) {
+    return Qnil;
+  }
+
+  return rb_ary_entry(rb_mysql_result_rows_at(self, wrapper, i, 1), 0);
+}
+
+/* call-seq: result.slice(offset, length)
+ *
+ * Up to +length+ rows from +offset+ on, counting back from the end when it's
+ * negative, like Array#slice. A stored or spilled result only decodes those
+ * rows, so a page of a big result doesn't need #each to go through the rows
+ * before it. Rows #each already cached are returned as they are, rows read
+ * here are cached too unless :cache_rows is false.
+ */
+static VALUE rb_mysql_result_slice(VALUE self, VALUE offsetValue, VALUE lengthValue) {
+  mysql2_result_wrapper * wrapper;
+  long offset = NUM2LONG(offsetValue);
+  long length = NUM2LONG(lengthValue);
+  long numberOfRows;
+
+  GetMysql2Result(self, wrapper);
+  numberOfRows = rb_mysql_result_random_access_count(self);
+  if (offset < 0) {
+    offset += numberOfRows;
+  }
+  if (offset < 0 || offset > numberOfRows || length < 0) {
+    return Qnil;
+  }
+  if (length > numberOfRows - offset) {
+    length = numberOfRows - offset;
+  }
+
+  return rb_mysql_result_rows_at(self, wrapper, offset, length);
+}
+
 /* Mysql2::Result */
-VALUE rb_mysql_result_to_obj(MYSQL_RES * r) {
+VALUE rb_mysql_result_to_obj(MYSQL_RES * r, VALUE client) {
   VALUE obj;
   mysql2_result_wrapper * wrapper;
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+  obj = TypedData_Make_Struct(cMysql2Result, mysql2_result_wrapper, &rb_mysql_result_type, wrapper);
+#else
   obj = Data_Make_Struct(cMysql2Result, mysql2_result_wrapper, rb_mysql_result_mark, rb_mysql_result_free, wrapper);
+#endif
   wrapper->numberOfFields = 0;
   wrapper->numberOfRows = 0;
   wrapper->lastRowProcessed = 0;
   wrapper->resultFreed = 0;
   wrapper->result = r;
+  wrapper->cacheEntry = NULL;
+  wrapper->cacheCursor = NULL;
+  wrapper->prefetch = NULL;
+  wrapper->spill = NULL;
+  wrapper->rowClass = Qnil;
+  wrapper->rowMembers = NULL;
+  wrapper->rowArity = 0;
+  wrapper->columnsFor = Qnil;
+  wrapper->columns = NULL;
+  wrapper->numberOfColumns = 0;
+  wrapper->columnsSkip = 0;
+  wrapper->castersFor = Qnil;
+  wrapper->casters = NULL;
+  wrapper->casterCalls = Qnil;
+  // streamed results only ever hold one row, cached ones are accounted for by the cache
+  wrapper->resultSize = (r != NULL && NIL_P(client)) ? mysql2_result_data_size(r) : 0;
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+  rb_gc_adjust_memory_usage((ssize_t)wrapper->resultSize);
+#endif
   wrapper->fields = Qnil;
   wrapper->rows = Qnil;
   wrapper->encoding = Qnil;
+  wrapper->internedStrings = Qnil;
+  RB_OBJ_WRITE(obj, &wrapper->client, client);
   wrapper->streamingComplete = 0;
   rb_obj_call_init(obj, 0, NULL);
   return obj;
 }
 
+/* hands the wrapper's rows over to +entry+, which the cache accounts for */
+static void rb_mysql_result_attach_cache(mysql2_result_wrapper * wrapper, mysql2_cache_entry *entry) {
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+  rb_gc_adjust_memory_usage(-(ssize_t)wrapper->resultSize);
+#endif
+  wrapper->resultSize = 0;
+  wrapper->result = mysql2_cache_result(entry);
+  wrapper->cacheEntry = entry;
+  wrapper->cacheCursor = wrapper->result->data->data;
+}
+
+/* a Result reading the cached rows for +key+, or nil if there are none */
+VALUE rb_mysql_result_from_cache(VALUE key) {
+  mysql2_cache_entry *entry;
+  mysql2_result_wrapper * wrapper;
+  VALUE obj;
+
+  entry = mysql2_cache_lookup(StringValueCStr(key));
+  if (entry == NULL) {
+    return Qnil;
+  }
+
+  obj = rb_mysql_result_to_obj(NULL, Qnil);
+  GetMysql2Result(obj, wrapper);
+  rb_mysql_result_attach_cache(wrapper, entry);
+  return obj;
+}
+
+/*
+ * Offers the rows of a freshly stored result to the cache, the Result keeps
+ * reading them from there. Results too big for the budget are left alone.
+ */
+void rb_mysql_result_store_in_cache(VALUE self, VALUE key, double ttl, VALUE sql) {
+  mysql2_cache_entry *entry;
+  mysql2_result_wrapper * wrapper;
+  size_t bytes;
+
+  GetMysql2Result(self, wrapper);
+  if (wrapper->resultFreed || wrapper->cacheEntry || wrapper->result->data == NULL) {
+    return;
+  }
+
+  bytes = wrapper->resultSize + mysql_num_fields(wrapper->result) * sizeof(MYSQL_FIELD);
+  entry = mysql2_cache_insert(StringValueCStr(key), wrapper->result, bytes, ttl, RSTRING_PTR(sql), RSTRING_LEN(sql));
+  if (entry) {
+    rb_mysql_result_attach_cache(wrapper, entry);
+  }
+}
+
 void init_mysql2_result() {
   cBigDecimal = rb_const_get(rb_cObject, rb_intern("BigDecimal"));
+  rb_global_variable(&cBigDecimal);
   cDate = rb_const_get(rb_cObject, rb_intern("Date"));
+  rb_global_variable(&cDate);
   cDateTime = rb_const_get(rb_cObject, rb_intern("DateTime"));
+  rb_global_variable(&cDateTime);
 
   cMysql2Result = rb_define_class_under(mMysql2, "Result", rb_cObject);
   rb_define_method(cMysql2Result, "each", rb_mysql_result_each, -1);
   rb_define_method(cMysql2Result, "fields", rb_mysql_result_fetch_fields, 0);
   rb_define_method(cMysql2Result, "count", rb_mysql_result_count, 0);
+  rb_define_method(cMysql2Result, "[]", rb_mysql_result_aref, 1);
+  rb_define_method(cMysql2Result, "slice", rb_mysql_result_slice, 2);
   rb_define_alias(cMysql2Result, "size", "count");
 
   intern_encoding_from_charset = rb_intern("encoding_from_charset");
   intern_encoding_from_charset_code = rb_intern("encoding_from_charset_code");
 
   intern_new          = rb_intern("new");
+  intern_members      = rb_intern("members");
+  intern_call         = rb_intern("call");
+  intern_parse        = rb_intern("parse");
+  intern_to_r         = rb_intern("to_r");
+  intern_to_i         = rb_intern("to_i");
+  intern_mult         = rb_intern("*");
+  intern_pow          = rb_intern("**");
   intern_utc          = rb_intern("utc");
   intern_local        = rb_intern("local");
   intern_merge        = rb_intern("merge");
@@ -602,6 +2527,23 @@ void init_mysql2_result() {
   sym_cache_rows     = ID2SYM(rb_intern("cache_rows"));
   sym_cast           = ID2SYM(rb_intern("cast"));
   sym_stream         = ID2SYM(rb_intern("stream"));
+  sym_decimal_as     = ID2SYM(rb_intern("decimal_as"));
+  sym_big_decimal    = ID2SYM(rb_intern("big_decimal"));
+  sym_float          = ID2SYM(rb_intern("float"));
+  sym_rational       = ID2SYM(rb_intern("rational"));
+  sym_scaled_int     = ID2SYM(rb_intern("scaled_int"));
+  sym_intern         = ID2SYM(rb_intern("intern"));
+  sym_freeze_strings = ID2SYM(rb_intern("freeze_strings"));
+  sym_decode_threads = ID2SYM(rb_intern("decode_threads"));
+  sym_prefetch       = ID2SYM(rb_intern("prefetch"));
+  sym_columns        = ID2SYM(rb_intern("columns"));
+  sym_skip_columns   = ID2SYM(rb_intern("skip_columns"));
+  sym_casters        = ID2SYM(rb_intern("casters"));
+  sym_string         = ID2SYM(rb_intern("string"));
+  sym_boolean        = ID2SYM(rb_intern("boolean"));
+  sym_unsigned       = ID2SYM(rb_intern("unsigned"));
+  sym_json           = ID2SYM(rb_intern("json"));
+  sym_uuid           = ID2SYM(rb_intern("uuid"));
 
   opt_decimal_zero = rb_str_new2("0.0");
   rb_global_variable(&opt_decimal_zero); //never GC
@@ -2,20 +2,47 @@
 #define MYSQL2_RESULT_H
 
 void init_mysql2_result();
-VALUE rb_mysql_result_to_obj(MYSQL_RES * r);
+VALUE rb_mysql_result_to_obj(MYSQL_RES * r, VALUE client);
+VALUE rb_mysql_result_from_cache(VALUE key);
+void rb_mysql_result_store_in_cache(VALUE self, VALUE key, double ttl, VALUE sql);
+#ifdef HAVE_SYS_MMAN_H
+void rb_mysql_result_spill(VALUE self, VALUE dir);
+#endif
 
 typedef struct {
   VALUE fields;
   VALUE rows;
   VALUE encoding;
+  VALUE internedStrings;
+  VALUE client;                          /* the Mysql2::Client a streamed result reads from, nil for stored rows */
   unsigned int numberOfFields;
   unsigned long numberOfRows;
   unsigned long lastRowProcessed;
+  size_t resultSize; /* bytes held by a stored MYSQL_RES, see mysql2_result_data_size */
   char streamingComplete;
   char resultFreed;
   MYSQL_RES *result;
+  struct mysql2_cache_entry *cacheEntry; /* set when result belongs to the result cache */
+  MYSQL_ROWS *cacheCursor;               /* next row to read from a cached result */
+  struct mysql2_prefetch *prefetch;      /* reader thread state for :prefetch, or NULL */
+  struct mysql2_spill *spill;            /* the file the rows were spilled to with :spill, or NULL */
+  VALUE rowClass;                        /* the :as class rowMembers was worked out for */
+  int *rowMembers;                       /* the field read into each Struct member, -1 for none, NULL for every field in order */
+  unsigned int rowArity;
+  VALUE columnsFor;                      /* the :columns or :skip_columns names columns was worked out for */
+  unsigned int *columns;                 /* the fields that go into a row, in order */
+  unsigned int numberOfColumns;
+  char columnsSkip;
+  VALUE castersFor;                      /* the :casters Hash casters was worked out for */
+  char *casters;                         /* each field's caster, see enum mysql2_caster */
+  VALUE casterCalls;                     /* the callable casters, by field */
 } mysql2_result_wrapper;
 
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+extern const rb_data_type_t rb_mysql_result_type;
+#define GetMysql2Result(obj, sval) TypedData_Get_Struct(obj, mysql2_result_wrapper, &rb_mysql_result_type, sval);
+#else
 #define GetMysql2Result(obj, sval) (sval = (mysql2_result_wrapper*)DATA_PTR(obj));
+#endif
 
 #endif
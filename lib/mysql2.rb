@@ -8,6 +8,9 @@ require 'mysql2/error'
 require 'mysql2/result'
 require 'mysql2/mysql2'
 require 'mysql2/client'
+require 'mysql2/routing_client'
+require 'mysql2/parallel_scan'
+require 'mysql2/binlog_stream'
 
 # = Mysql2
 #
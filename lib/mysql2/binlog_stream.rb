@@ -0,0 +1,91 @@
+module Mysql2
+  # Follows a server's binary log the way a replica does and yields the rows
+  # each statement wrote, for change data capture. The server needs
+  # binlog_format=ROW (and binlog_row_image=FULL for whole rows), the user
+  # REPLICATION SLAVE and REPLICATION CLIENT.
+  #
+  #   stream = Mysql2::BinlogStream.new(:host => "db1", :username => "cdc", :server_id => 4242)
+  #   stream.each do |event|
+  #     event # => {:type => :insert, :database => "shop", :table => "orders", :rows => [{"id" => 7, ...}],
+  #           #     :timestamp => 2026-10-18 12:00:00 +0200}
+  #   end
+  #   stream.position # => ["binlog.000012", 4711], after the last transaction read
+  #
+  # The event decoding is in ext/mysql2/binlog.c, it's only there when the
+  # gem was built against MySQL 5.7 or later.
+  class BinlogStream
+    include Enumerable
+
+    # Takes Mysql2::Client options for the two connections it opens, one to
+    # read the log and one to look up its tables' columns, and:
+    #
+    #   :server_id  - the replica id to register as, unique among the server's replicas (required)
+    #   :file       - the binlog file to start in, the server's current one by default
+    #   :position   - where to start in :file (4, its first event), a transaction boundary like #position
+    #   :batch_size - most events yielded at once by #each_batch (100)
+    def initialize(opts = {})
+      unless respond_to?(:_open, true)
+        raise NotImplementedError, "Mysql2::BinlogStream needs mysql2 built against MySQL 5.7 or later"
+      end
+
+      opts = Mysql2::Util.key_hash_as_symbols(opts)
+      server_id = opts.delete(:server_id) or raise ArgumentError, "Mysql2::BinlogStream needs a :server_id"
+      file = opts.delete(:file)
+      position = opts.delete(:position) || 4
+      @batch_size = opts.delete(:batch_size) || 100
+
+      @schema = Mysql2::Client.new(opts)
+      @client = Mysql2::Client.new(opts)
+      file, position = current_position unless file
+      # tell the server we can read the checksums it puts on events, it won't send the log otherwise
+      checksum = @client.query("SELECT @@global.binlog_checksum AS checksum").first['checksum']
+      @client.query("SET @master_binlog_checksum = @@global.binlog_checksum, @source_binlog_checksum = @@global.binlog_checksum")
+      _open(@client, file, position, server_id, checksum.to_s.upcase != 'NONE')
+    rescue Exception
+      close
+      raise
+    end
+
+    def each(&block)
+      each_batch { |events| events.each(&block) }
+    end
+
+    # Yields Arrays of events. A batch ends at a commit, or after :batch_size
+    # events when a transaction has more. Runs until the server closes the
+    # connection, or the client is closed from another thread.
+    def each_batch
+      while (events = _fetch(@batch_size))
+        yield events unless events.empty?
+      end
+      self
+    end
+
+    def close
+      @client.close if @client
+      @schema.close if @schema
+      nil
+    end
+
+    private
+      def current_position
+        status = begin
+          @client.query("SHOW BINARY LOG STATUS").first
+        rescue Mysql2::Error
+          # before MySQL 8.2
+          @client.query("SHOW MASTER STATUS").first
+        end
+        raise Mysql2::Error, "binary logging is off on this server" unless status
+        [status['File'], status['Position']]
+      end
+
+      # Called from the extension with each new table id, [column names,
+      # whether each is an UNSIGNED number], which the binlog leaves out. A
+      # table gets a new id after every ALTER, so this isn't cached.
+      def table_columns(database, table)
+        columns = @schema.query("SELECT COLUMN_NAME, COLUMN_TYPE FROM information_schema.COLUMNS " \
+                                "WHERE TABLE_SCHEMA = '#{@schema.escape(database)}' AND TABLE_NAME = '#{@schema.escape(table)}' " \
+                                "ORDER BY ORDINAL_POSITION").each(:as => :array).to_a
+        [columns.map { |name, _| name }, columns.map { |_, type| type.to_s =~ /\bunsigned\b/i ? true : false }]
+      end
+  end
+end
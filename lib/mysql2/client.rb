@@ -1,15 +1,54 @@
 module Mysql2
   class Client
-    attr_reader :query_options
+    attr_reader :query_options, :reconnect_stats
+
+    # the connection is gone: CR_SERVER_GONE_ERROR, CR_SERVER_LOST
+    CONNECTION_LOST_ERRORS = [2006, 2013]
+    # statements :retry_reads runs again on a new connection
+    REPLAYABLE_QUERY = /\A\s*(?:SELECT|SHOW|DESCRIBE|DESC|EXPLAIN)\b/i
+    # ...unless they take locks or write somewhere; FOR UPDATE and FOR SHARE
+    # also cover their NOWAIT and SKIP LOCKED forms
+    LOCKING_QUERY = /\bFOR\s+(?:UPDATE|SHARE)\b|\bLOCK\s+IN\s+SHARE\s+MODE\b|\bINTO\b|\bGET_LOCK\b/i
+    MAX_RETRY_BACKOFF = 2.0
+    # statements that leave state on the connection which other connections
+    # don't have, cached results read after one stay with this connection
+    SESSION_STATE_QUERY = /\A\s*(?:SET|USE|CALL|PREPARE|LOCK)\b|\bTEMPORARY\b|@\w+\s*:=|\bINTO\s+@/i
+    # string literals and quoted names, skipped when looking for keywords
+    QUOTED = /'(?:[^'\\]|\\.)*'|"(?:[^"\\]|\\.)*"|`[^`]*`/
+    # clauses an each_batch template can't have, it adds its own
+    KEYSET_CLAUSES = /\b(?:WHERE|GROUP\s+BY|HAVING|ORDER\s+BY|LIMIT|UNION)\b/i
+
+    # options that pick the server and account, clients that agree on these
+    # share one side connection for #cancel
+    CANCEL_OPTIONS = [:username, :user, :password, :pass, :host, :hostname, :port, :socket, :sock, :flags,
+                      :sslkey, :sslcert, :sslca, :sslcapath, :sslcipher, :ssl_mode, :connect_timeout]
+
+    @@cancellers = {}
+    @@canceller_lock = Mutex.new
+    @@cache_scopes = 0
+    @@cache_scope_lock = Mutex.new
+
     @@default_query_options = {
-      :as => :hash,                   # the type of object you want each row back as; also supports :array (an array of values)
+      :as => :hash,                   # the type of object you want each row back as; also supports :array (an array of values) and a Struct or other class
       :async => false,                # don't wait for a result after sending the query, you'll have to monitor the socket yourself then eventually call Mysql2::Client#async_result
       :cast_booleans => false,        # cast tinyint(1) fields as true/false in ruby
+      :decimal_as => :big_decimal,    # how DECIMAL fields with a scale are returned; also supports :float, :rational and :scaled_int
       :symbolize_keys => false,       # return field names as symbols instead of strings
       :database_timezone => :local,   # timezone Mysql2 will assume datetime objects are stored in
       :application_timezone => nil,   # timezone Mysql2 will convert to before handing the object back to the caller
       :cache_rows => true,            # tells Mysql2 to use it's internal row cache for results
+      :freeze_strings => false,       # return frozen Strings
+      :decode_threads => nil,         # threads used to parse numeric and date fields of a non-streamed result
+      :prefetch => nil,               # rows a streamed result reads ahead on a background thread while the block runs
+      :casters => nil,                # { field name, column type Symbol or :unsigned => :json, :boolean, :unsigned, :uuid, :string or a callable }
+      :columns => nil,                # names of the only fields to build rows from, in that order
+      :skip_columns => nil,           # names of fields to leave out of rows
+      :spill => nil,                  # read a result into an unlinked temp file (true for $TMPDIR, or a directory) instead of memory; per query, never kept as a default
+      :intern => false,               # return shared frozen Strings for ENUM/SET fields (true) plus any field named in an Array
       :connect_flags => REMEMBER_OPTIONS | LONG_PASSWORD | LONG_FLAG | TRANSACTIONS | PROTOCOL_41 | SECURE_CONNECTION,
+      :timeout => nil,                # seconds (Float for sub-second) to wait for a query's result, overrides :read_timeout
+      :on_timeout => :disconnect,     # what to do when a query times out; :cancel to KILL QUERY it and keep the connection
+      :cache => nil,                  # seconds to keep a query's rows in the process-wide result cache and answer repeats of it from there; per query, never kept as a default
       :cast => true
     }
 
@@ -20,7 +59,7 @@ module Mysql2
 
       init_connection
 
-      [:reconnect, :connect_timeout].each do |key|
+      [:reconnect, :connect_timeout, :write_timeout, :compress, :compression_level, :ssl_mode, :shutdown_on_interrupt].each do |key|
         next unless opts.key?(key)
         send(:"#{key}=", opts[key])
       end
@@ -29,9 +68,22 @@ module Mysql2
 
       @read_timeout = opts[:read_timeout]
       if @read_timeout and @read_timeout < 0
-        raise Mysql2::Error, "read_timeout must be a positive integer, you passed #{@read_timeout}"
+        raise Mysql2::Error, "read_timeout must be a positive number, you passed #{@read_timeout}"
       end
 
+      # kept around so #cancel can open a side connection to the same server
+      @connect_options = opts
+
+      @retry_reads    = opts[:retry_reads]
+      @retry_attempts = opts[:retry_attempts] || 5
+      @retry_backoff  = opts[:retry_backoff] || 0.05
+      # a new connection has no session state of its own yet
+      @cache_scope = nil
+      # these survive #reconnect!, which runs through here again;
+      # [sql, variables it sets] for the SETs to replay, in the order they ran
+      @session_statements ||= []
+      @reconnect_stats ||= { :reconnects => 0, :failed_reconnects => 0, :retries => 0 }
+
       ssl_set(*opts.values_at(:sslkey, :sslcert, :sslca, :sslcapath, :sslcipher))
       
       if [:user,:pass,:hostname,:dbname,:db,:sock].any?{|k| @query_options.has_key?(k) }
@@ -49,13 +101,217 @@ module Mysql2
       socket   = opts[:socket] || opts[:sock]
       flags    = opts[:flags] ? opts[:flags] | @query_options[:connect_flags] : @query_options[:connect_flags]
 
+      started = Time.now
       connect user, pass, host, port, database, socket, flags
+      @connect_time = Time.now - started
     end
 
     def self.default_query_options
       @@default_query_options
     end
 
+    # Open +count+ connections with the same +opts+ at once. The handshakes
+    # (TCP, auth and charset setup) run outside the GVL, so connecting on one
+    # thread per client lets their round trips overlap. If any of them fails the
+    # others are closed and the error is raised.
+    def self.connect_many(count, opts = {})
+      threads = Array.new(count) do
+        Thread.new do
+          begin
+            new(opts)
+          ensure
+            # these threads won't call into libmysql again
+            thread_end
+          end
+        end
+      end
+      clients, error = [], nil
+      threads.each do |thread|
+        begin
+          clients << thread.value
+        rescue Exception => e
+          error ||= e
+        end
+      end
+      if error
+        clients.each { |client| client.close }
+        raise error
+      end
+      clients
+    end
+
+    # Whether this connection's traffic is compressed, and how many bytes
+    # actually went over the wire for it so far, as counted by the server.
+    # Compare the counters from before and after a query to see what it cost.
+    def compression_stats
+      status = {}
+      # options given to #each, unlike #query's, don't stay on the client
+      query("SHOW SESSION STATUS WHERE Variable_name IN ('Compression', 'Compression_algorithm', 'Bytes_sent', 'Bytes_received')").each(:as => :array) do |name, value|
+        status[name] = value
+      end
+      compressed = status['Compression'] == 'ON'
+      {
+        :compression    => compressed,
+        :algorithm      => compressed ? (status['Compression_algorithm'] || 'zlib') : nil,
+        :bytes_sent     => status['Bytes_sent'].to_i,
+        :bytes_received => status['Bytes_received'].to_i
+      }
+    end
+
+    # Stop the query this connection is currently running by sending
+    # KILL QUERY for it over a second connection. Unlike a timeout with the
+    # default :on_timeout => :disconnect this leaves the connection open, the
+    # interrupted query returns early or raises.
+    #
+    # The second connection is shared by every client of the process that
+    # connects to the same server as the same user, it's opened on the first
+    # cancel and kept for the next ones until it fails.
+    def cancel
+      key = @connect_options.reject { |k, _| !CANCEL_OPTIONS.include?(k) }
+      @@canceller_lock.synchronize do
+        begin
+          canceller = (@@cancellers[key] ||= Mysql2::Client.new(key))
+          canceller.query("KILL QUERY #{thread_id}")
+        rescue Mysql2::Error
+          canceller = @@cancellers.delete(key)
+          canceller.close if canceller
+          raise
+        end
+      end
+      nil
+    end
+
+    # #query keeps the options it's given as the client's defaults for the
+    # next queries. Code running queries on someone else's client wraps them
+    # in this, the options are put back once the block returns.
+    def preserving_query_options
+      saved = @query_options
+      yield self
+    ensure
+      @query_options = saved
+    end
+
+    # Drop every cached result read from +table+ (or "db.table"), for use
+    # after writing to it. See Mysql2::Client.invalidate_result_cache.
+    def invalidate(table)
+      self.class.invalidate_result_cache(table)
+    end
+
+    alias_method :query_without_retry, :query
+    private :query_without_retry
+
+    # See Mysql2::Client#query_without_retry (implemented in C). With
+    # :retry_reads, a connection lost while running a read-only query
+    # outside a transaction is reconnected and the query run again.
+    def query(sql, *args)
+      scope_result_cache(sql)
+      opts = args.first || {}
+      if !@retry_reads || (opts.key?(:async) ? opts[:async] : @query_options[:async])
+        return query_without_retry(sql, *args)
+      end
+
+      replayable = sql =~ REPLAYABLE_QUERY && sql !~ LOCKING_QUERY && !in_transaction?
+      attempts = 0
+      begin
+        result = query_without_retry(sql, *args)
+        track_session_state(sql)
+        result
+      rescue Mysql2::Error => e
+        raise unless CONNECTION_LOST_ERRORS.include?(e.error_number)
+        # whatever happens to the query, leave a working connection behind
+        reconnect!
+        attempts += 1
+        raise e unless replayable && attempts <= @retry_attempts
+        @reconnect_stats[:retries] += 1
+        retry
+      end
+    end
+
+    alias_method :select_db_without_tracking, :select_db
+    private :select_db_without_tracking
+
+    def select_db(db)
+      select_db_without_tracking(db)
+      @connect_options = @connect_options.merge(:database => db)
+      db
+    end
+
+    # Drop this connection and open a new one with the same options, back on
+    # the database last picked with #select_db and, with :retry_reads, with
+    # the SET statements run so far replayed. Failed attempts are retried
+    # :retry_attempts times, waiting :retry_backoff seconds and twice as long
+    # after each further failure (up to MAX_RETRY_BACKOFF).
+    def reconnect!
+      attempts = 0
+      begin
+        reset_connection
+        restore_session
+        @reconnect_stats[:reconnects] += 1
+        self
+      rescue Mysql2::Error
+        @reconnect_stats[:failed_reconnects] += 1
+        attempts += 1
+        raise if attempts > @retry_attempts
+        sleep [@retry_backoff * (2 ** (attempts - 1)), MAX_RETRY_BACKOFF].min
+        retry
+      end
+    end
+
+    # Read the rows of +sql_template+ a batch at a time with keyset
+    # pagination: each batch is the next :batch_size rows ordered by :key and
+    # past the last key seen, so nothing is held open on the server between
+    # batches. The next batch is sent with :async => true before the current
+    # one is yielded, so it's on its way while the block works. The block must
+    # not use this client.
+    #
+    # +sql_template+ is a SELECT ... FROM without WHERE, GROUP BY, HAVING,
+    # ORDER BY, LIMIT or UNION, anything else is rejected. Its own condition
+    # goes in :where, the key condition, ORDER BY and LIMIT are added. :key
+    # must be unique and be in the select list, as :key_field if it's named
+    # differently there.
+    #
+    #   client.each_batch("SELECT * FROM orders", :where => "status = 'shipped'", :key => "id", :batch_size => 5000) do |result|
+    #     result.each { |row| ... }
+    #   end
+    def each_batch(sql_template, opts = {})
+      return enum_for(:each_batch, sql_template, opts) unless block_given?
+
+      opts = opts.dup
+      key = opts.delete(:key) or raise ArgumentError, "each_batch needs a :key column"
+      batch_size = opts.delete(:batch_size) || 1000
+      where = opts.delete(:where)
+      field = opts.delete(:key_field) || key.to_s.split('.').last.delete('`')
+      if sql_template.gsub(QUOTED, '') =~ KEYSET_CLAUSES
+        raise ArgumentError, "each_batch's template can't have its own #{$&.upcase}, pass conditions as :where"
+      end
+      # the last key is read off the rows before the batch is yielded
+      opts = opts.merge(:stream => false, :cache_rows => true)
+      saved_options = @query_options
+      pending = false
+
+      result = query(keyset_sql(sql_template, where, key, nil, batch_size), opts.merge(:async => false))
+      loop do
+        rows = result.to_a
+        break if rows.empty?
+        if rows.size == batch_size
+          last = keyset_value(result, rows.last, field)
+          query(keyset_sql(sql_template, where, key, last, batch_size), opts.merge(:async => true))
+          pending = true
+        end
+        yield result
+        break unless pending
+        pending = false
+        result = async_result
+      end
+      nil
+    ensure
+      # a block that raised or broke out leaves the prefetched batch unread
+      if pending
+        async_result rescue nil
+      end
+      @query_options = saved_options if saved_options
+    end
+
     # NOTE: from ruby-mysql
     if defined? Encoding
       CHARSET_MAP = {
@@ -265,6 +521,91 @@ module Mysql2
     end
 
     private
+      # Called from C the first time this client is used in a process forked
+      # after it connected. Query options set on the client since it was
+      # created are kept.
+      def reconnect_after_fork
+        restore_session
+      end
+
+      # reconnect on a reset connection, keeping query options set on the
+      # client since it was created
+      def restore_session
+        query_options = @query_options
+        initialize(@connect_options)
+        @query_options = query_options
+        @session_statements.each do |sql, _|
+          scope_result_cache(sql)
+          query_without_retry(sql)
+        end
+      end
+
+      # Gives the connection a result cache scope of its own once it has run
+      # something like SET time_zone or CREATE TEMPORARY TABLE, and a new one
+      # after every further such statement, so other connections (and this
+      # one, before the change) never see results that depend on it.
+      def scope_result_cache(sql)
+        return unless sql.is_a?(String) && sql =~ SESSION_STATE_QUERY
+        @cache_scope = @@cache_scope_lock.synchronize { @@cache_scopes += 1 }
+      end
+
+      # A SET replaces the earlier ones whose variables it sets again, so the
+      # replay ends with the latest values and stays as long as the number of
+      # variables set.
+      def track_session_state(sql)
+        if sql =~ /\A\s*SET\s/i
+          variables = session_variables(sql)
+          @session_statements.reject! { |_, earlier| (earlier - variables).empty? }
+          @session_statements << [sql, variables]
+        elsif sql =~ /\A\s*USE\s+`?([^`\s;]+)`?/i
+          @connect_options = @connect_options.merge(:database => $1)
+        end
+      end
+
+      # the variables a SET assigns, as names like "@a" or "time_zone", or the
+      # kind of SET for the ones without an =, like SET NAMES
+      def session_variables(sql)
+        body = sql.sub(/\A\s*SET\s+/i, '').gsub(/'(?:[^'\\]|\\.)*'|"(?:[^"\\]|\\.)*"/, "''")
+        # values can be expressions with commas and = of their own
+        nil while body.gsub!(/\([^()]*\)/, '')
+        variables = body.scan(/([@\w.`]+)\s*:?=/).map do |(name)|
+          name.delete('`').downcase.sub(/\A@@(?:session\.|local\.)?/, '')
+        end
+        variables.empty? ? [body[/\A\s*(\w+(?:\s+SET)?)/i, 1].to_s.upcase] : variables.uniq
+      end
+
+      def keyset_sql(template, where, key, after, limit)
+        conditions = []
+        conditions << "(#{where})" if where
+        conditions << "#{key} > #{keyset_literal(after)}" unless after.nil?
+        sql = conditions.empty? ? template : "#{template} WHERE #{conditions.join(' AND ')}"
+        "#{sql} ORDER BY #{key} LIMIT #{limit}"
+      end
+
+      def keyset_value(result, row, field)
+        index = result.fields.map { |name| name.to_s }.index(field)
+        raise ArgumentError, "each_batch's key #{field} isn't in the select list" unless index
+        case row
+        when Array then row[index]
+        when Struct then row[field]
+        else row[result.fields[index]]
+        end
+      end
+
+      def keyset_literal(value)
+        case value
+        when BigDecimal then value.to_s('F')
+        when Numeric then value.to_s
+        when ::Time, DateTime
+          # the server compares against the zone the column is stored in
+          value = value.to_time
+          value = @query_options[:database_timezone] == :utc ? value.getutc : value.getlocal
+          "'#{value.strftime('%Y-%m-%d %H:%M:%S.%6N')}'"
+        when Date then "'#{value.strftime('%Y-%m-%d')}'"
+        else "'#{escape(value.to_s)}'"
+        end
+      end
+
       def self.local_offset
         ::Time.local(2010).utc_offset.to_r / 86400
       end
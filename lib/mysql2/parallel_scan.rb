@@ -0,0 +1,161 @@
+require 'thread'
+
+module Mysql2
+  # Reads a whole table over several connections at once. The range of an
+  # integer key column is cut into chunks of +chunk_size+ keys and each client
+  # streams one chunk at a time on its own thread. The chunks are read with
+  # :prefetch, so reading rows off the socket and parsing their numeric and
+  # date fields happen without the GVL and overlap across connections; only
+  # building the row Hashes and Arrays still takes turns.
+  #
+  #   scan = Mysql2::ParallelScan.new(clients, "orders", "id", 100_000)
+  #   scan.each { |row| ... }
+  #   scan.chunk_stats # => [{:chunk => 0, :from => 1, :to => 100001, :rows => 99874, :seconds => 0.41, ...}, ...]
+  class ParallelScan
+    include Enumerable
+
+    # batches buffered for each chunk (ordered) or for each client (unordered)
+    QUEUE_DEPTH = 4
+
+    attr_reader :chunk_stats
+
+    # +table+ and +key_column+ go into the SQL as they are. Options:
+    #
+    #   :ordered    - yield the chunks in key order (true) or as they're read
+    #   :batch_size - rows per batch passed from the clients' threads (1000)
+    #   :columns    - the select list ("*")
+    #   :where      - a condition the rows must also meet
+    #   :on_chunk   - called with each chunk's stats once it's been read
+    #   :prefetch   - rows each client reads ahead (:batch_size), nil to turn it off
+    #
+    # Anything else is passed on to Mysql2::Client#query.
+    def initialize(clients, table, key_column, chunk_size, opts = {})
+      raise ArgumentError, "ParallelScan needs at least one client" if clients.empty?
+      raise ArgumentError, "chunk_size must be positive" unless chunk_size > 0
+
+      opts = opts.dup
+      @clients = clients
+      @table = table
+      @key = key_column
+      @chunk_size = chunk_size
+      @ordered = opts.key?(:ordered) ? opts.delete(:ordered) : true
+      @batch_size = opts.delete(:batch_size) || 1000
+      @columns = opts.delete(:columns) || "*"
+      @where = opts.delete(:where)
+      @on_chunk = opts.delete(:on_chunk)
+      @query_options = opts.merge(:stream => true, :cache_rows => false)
+      @query_options[:prefetch] = @batch_size unless opts.key?(:prefetch)
+      @chunk_stats = []
+    end
+
+    def each(&block)
+      each_batch { |batch| batch.each(&block) }
+    end
+
+    # Yields Arrays of up to :batch_size rows, all from the same chunk
+    def each_batch
+      chunks = self.chunks
+      @chunk_stats = Array.new(chunks.size)
+      return self if chunks.empty?
+
+      @stopped = false
+      work = Queue.new
+      chunks.each_with_index { |range, index| work << [index, range] }
+      outputs = @ordered ? chunks.map { SizedQueue.new(QUEUE_DEPTH) } : [SizedQueue.new(QUEUE_DEPTH * @clients.size)]
+      threads = []
+      @clients.each_with_index do |client, i|
+        threads << Thread.new { scan_chunks(client, i, work, outputs) }
+      end
+
+      finished = 0
+      while finished < chunks.size
+        kind, index, payload = outputs[@ordered ? finished : 0].pop
+        case kind
+        when :rows
+          yield payload
+        when :done
+          @chunk_stats[index] = payload
+          @on_chunk.call(payload) if @on_chunk
+          finished += 1
+        when :error
+          raise payload
+        end
+      end
+      self
+    ensure
+      if threads
+        # a thread blocked on a full queue pushes once more at most, then
+        # reads what's left of its chunk so its connection stays usable
+        @stopped = true
+        outputs.each { |queue| queue.clear }
+        threads.each { |thread| thread.join }
+      end
+    end
+
+    # [from, to) key ranges covering the table
+    def chunks
+      sql = "SELECT MIN(#{@key}), MAX(#{@key}) FROM #{@table}"
+      sql << " WHERE #{@where}" if @where
+      client = @clients.first
+      low, high = client.preserving_query_options { client.query(sql, :as => :array, :cast => true).first }
+      return [] if low.nil?
+
+      ranges = []
+      low = low.to_i
+      high = high.to_i
+      while low <= high
+        ranges << [low, low + @chunk_size]
+        low += @chunk_size
+      end
+      ranges
+    end
+
+    private
+      def chunk_sql(from, to)
+        sql = "SELECT #{@columns} FROM #{@table} WHERE #{@key} >= #{from} AND #{@key} < #{to}"
+        sql << " AND (#{@where})" if @where
+        sql << " ORDER BY #{@key}" if @ordered
+        sql
+      end
+
+      def scan_chunks(client, connection, work, outputs)
+        index = nil
+        loop do
+          begin
+            index, (from, to) = work.pop(true)
+          rescue ThreadError
+            return
+          end
+          return if @stopped
+
+          output = outputs[@ordered ? index : 0]
+          started = Time.now
+          rows = 0
+          batch = []
+          result = client.preserving_query_options { client.query(chunk_sql(from, to), @query_options) }
+          result.each do |row|
+            next if @stopped
+            batch << row
+            if batch.size >= @batch_size
+              rows += batch.size
+              output << [:rows, index, batch]
+              batch = []
+            end
+          end
+          return if @stopped
+
+          unless batch.empty?
+            rows += batch.size
+            output << [:rows, index, batch]
+          end
+          seconds = Time.now - started
+          output << [:done, index, {
+            :chunk => index, :from => from, :to => to, :connection => connection, :rows => rows,
+            :seconds => seconds, :rows_per_second => seconds > 0 ? rows / seconds : nil
+          }]
+        end
+      rescue Exception => e
+        outputs[@ordered ? index : 0] << [:error, index, e] unless @stopped || index.nil?
+      end
+  end
+end
@@ -1,5 +1,18 @@
 module Mysql2
   class Result
     include Enumerable
+
+    # Like Enumerable#first, but a stored or spilled result only decodes the
+    # rows asked for (see #slice). Streamed results go through #each.
+    def first(n = nil)
+      if @query_options[:stream]
+        n.nil? ? super() : super(n)
+      elsif n.nil?
+        self[0]
+      else
+        raise ArgumentError, "attempt to take negative size" if n < 0
+        slice(0, n)
+      end
+    end
   end
 end
@@ -0,0 +1,286 @@
+module Mysql2
+  # Holds connections to a primary server and its replicas and picks one for
+  # each statement. Reads go to the least loaded healthy replica, everything
+  # else (writes, locking reads, anything inside a transaction) to the primary.
+  # After a write the thread that made it sticks to the primary for
+  # :pin_after_write seconds, so it reads its own writes whatever the
+  # replication lag.
+  #
+  # Can be shared between threads, every server gets up to :pool connections,
+  # opened as they're needed. A thread that dies inside a transaction has it
+  # rolled back and its connection handed back the next time the primary's
+  # connections are needed.
+  class RoutingClient
+    # latency is a moving average, this is the weight of the newest sample
+    LATENCY_WEIGHT = 0.2
+    # seconds between looks for connections left behind while waiting for one
+    RECLAIM_INTERVAL = 1.0
+
+    # One server and the connections open to it
+    class Backend
+      attr_reader :name, :in_flight, :latency, :queries, :failures
+
+      def initialize(opts, pool)
+        @opts = opts
+        @pool = pool
+        @name = "#{opts[:host] || 'localhost'}:#{opts[:port] || opts[:socket] || 3306}"
+        @idle = []
+        @open = 0
+        @in_flight = 0
+        @latency = nil
+        @queries = 0
+        @failures = 0
+        @down_until = nil
+        @lock = Mutex.new
+        @available = ConditionVariable.new
+      end
+
+      def healthy?
+        @down_until.nil? || Time.now >= @down_until
+      end
+
+      def mark_down(seconds)
+        @lock.synchronize do
+          @failures += 1
+          @down_until = Time.now + seconds
+        end
+      end
+
+      # how long a new query would take here, given what's running already
+      def load
+        (@in_flight + 1) * (@latency || 0.0)
+      end
+
+      # With a block, waiting for a connection stops every RECLAIM_INTERVAL
+      # seconds to call it, so it can hand back connections nobody else will.
+      def checkout
+        opened = false
+        until opened
+          @lock.synchronize do
+            if @idle.empty? && @open >= @pool
+              @available.wait(@lock, block_given? ? RECLAIM_INTERVAL : nil)
+            end
+            if !@idle.empty?
+              @in_flight += 1
+              return @idle.pop
+            elsif @open < @pool
+              @in_flight += 1
+              @open += 1
+              opened = true
+            end
+          end
+          yield if !opened && block_given?
+        end
+        begin
+          Mysql2::Client.new(@opts)
+        rescue Exception
+          checkin(nil)
+          raise
+        end
+      end
+
+      # +client+ is nil when it was lost and shouldn't be reused
+      def checkin(client)
+        @lock.synchronize do
+          @in_flight -= 1
+          if client
+            @idle.push(client)
+          else
+            @open -= 1
+          end
+          @available.signal
+        end
+      end
+
+      def record(seconds)
+        @lock.synchronize do
+          @queries += 1
+          @latency = @latency ? @latency + (seconds - @latency) * LATENCY_WEIGHT : seconds
+          @down_until = nil
+        end
+      end
+
+      def stats
+        { :name => @name, :healthy => healthy?, :in_flight => @in_flight, :latency => @latency,
+          :queries => @queries, :failures => @failures }
+      end
+
+      def close
+        @lock.synchronize do
+          @idle.each { |client| client.close }
+          @open -= @idle.size
+          @idle.clear
+        end
+      end
+    end
+
+    attr_reader :primary, :replicas
+
+    # Takes :primary, a Hash of Mysql2::Client options, and :replicas, an
+    # Array of them. Any other option applies to all of the connections, on
+    # top of these:
+    #
+    #   :pin_after_write        - seconds a thread keeps reading from the primary after a write (1.0)
+    #   :pool                   - connections per server (1)
+    #   :replica_retry_interval - seconds a replica that failed is left alone (5)
+    def initialize(opts = {})
+      opts = Mysql2::Util.key_hash_as_symbols(opts)
+      shared = opts.reject { |key, _| [:primary, :replicas, :pin_after_write, :pool, :replica_retry_interval].include?(key) }
+      pool = opts[:pool] || 1
+
+      @pin_after_write = opts[:pin_after_write] || 1.0
+      @replica_retry_interval = opts[:replica_retry_interval] || 5
+      @primary = Backend.new(shared.merge(Mysql2::Util.key_hash_as_symbols(opts[:primary] || {})), pool)
+      @replicas = (opts[:replicas] || []).map do |replica|
+        Backend.new(shared.merge(Mysql2::Util.key_hash_as_symbols(replica)), pool)
+      end
+      @session_key = :"mysql2_routing_client_#{object_id}"
+      # thread => the primary connection its open transaction runs on
+      @held = {}
+      @held_lock = Mutex.new
+    end
+
+    # Runs +sql+ on the server it should go to, see Mysql2::Client#query.
+    # Results are read fully before the connection is handed back, so
+    # :stream and :async aren't supported. +opts+ only apply to this query,
+    # the pooled connections keep their own defaults.
+    def query(sql, opts = {})
+      if opts[:stream] || opts[:async]
+        raise ArgumentError, "Mysql2::RoutingClient doesn't support :stream or :async queries"
+      end
+
+      if read?(sql) && !holding? && !pinned?
+        query_replica(sql, opts)
+      else
+        query_primary(sql, opts)
+      end
+    end
+
+    def escape(str)
+      Mysql2::Client.escape(str)
+    end
+
+    # Whether +sql+ may run on a replica
+    def read?(sql)
+      !!(sql =~ Client::REPLAYABLE_QUERY && sql !~ Client::LOCKING_QUERY)
+    end
+
+    # Whether this thread's statements go to the primary because of a recent write
+    def pinned?
+      pinned_until = session[:pinned_until]
+      !pinned_until.nil? && Time.now < pinned_until
+    end
+
+    def stats
+      { :primary => @primary.stats, :replicas => @replicas.map { |replica| replica.stats } }
+    end
+
+    def close
+      ([@primary] + @replicas).each { |backend| backend.close }
+      nil
+    end
+
+    private
+      def session
+        Thread.current[@session_key] ||= {}
+      end
+
+      def query_replica(sql, opts)
+        tried = []
+        loop do
+          candidates = @replicas.select { |replica| replica.healthy? && !tried.include?(replica) }
+          replica = candidates.min_by { |candidate| candidate.load }
+          return query_primary(sql, opts) unless replica
+
+          tried << replica
+          begin
+            return run(replica, sql, opts)
+          rescue Mysql2::Error => e
+            # only client errors (CR_*, 2000 and up) mean the replica is unreachable,
+            # a server error is just as much one on the next replica
+            raise unless e.error_number.to_i >= 2000
+            replica.mark_down(@replica_retry_interval)
+          end
+        end
+      end
+
+      def holding?
+        @held_lock.synchronize { @held.key?(Thread.current) }
+      end
+
+      # a connection that opened a transaction stays with this thread until it ends
+      def query_primary(sql, opts)
+        state = session
+        reclaim_held
+        client = @held_lock.synchronize { @held.delete(Thread.current) }
+        client ||= @primary.checkout { reclaim_held }
+        started = Time.now
+        lost = false
+        begin
+          result = client.preserving_query_options { client.query(sql, opts) }
+          @primary.record(Time.now - started)
+          state[:pinned_until] = Time.now + @pin_after_write unless read?(sql)
+          result
+        rescue Mysql2::Error => e
+          lost = lost?(client, e)
+          raise
+        ensure
+          if lost
+            client.close rescue nil
+            @primary.checkin(nil)
+          elsif client.in_transaction?
+            @held_lock.synchronize { @held[Thread.current] = client }
+          else
+            @primary.checkin(client)
+          end
+        end
+      end
+
+      # Rolls back the transactions of threads that died inside one and hands
+      # their connections back
+      def reclaim_held
+        clients = @held_lock.synchronize do
+          @held.keys.reject { |thread| thread.alive? }.map { |thread| @held.delete(thread) }
+        end
+        clients.each do |client|
+          begin
+            client.query("ROLLBACK")
+            @primary.checkin(client)
+          rescue Mysql2::Error
+            client.close rescue nil
+            @primary.checkin(nil)
+          end
+        end
+      end
+
+      # Server errors (below 2000) leave the connection as it was. Client
+      # errors may not, and neither may the ones mysql2 raises without a
+      # number: timeouts close the connection without a CR_SERVER_LOST,
+      # hence the ping.
+      def lost?(client, error)
+        number = error.error_number.to_i
+        return false if number > 0 && number < 2000
+        Client::CONNECTION_LOST_ERRORS.include?(number) || !client.ping
+      rescue Mysql2::Error
+        true
+      end
+
+      def run(backend, sql, opts)
+        client = backend.checkout
+        started = Time.now
+        begin
+          result = client.preserving_query_options { client.query(sql, opts) }
+          backend.record(Time.now - started)
+          result
+        rescue Mysql2::Error => e
+          if lost?(client, e)
+            client.close rescue nil
+            client = nil
+          end
+          raise
+        ensure
+          backend.checkin(client)
+        end
+      end
+  end
+end
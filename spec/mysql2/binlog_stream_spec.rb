@@ -0,0 +1,97 @@
+# encoding: UTF-8
+require 'spec_helper'
+
+describe Mysql2::BinlogStream do
+  before(:each) do
+    @client = Mysql2::Client.new :host => "localhost", :username => "root", :database => 'test'
+    pending("needs mysql2 built against MySQL 5.7+") unless Mysql2::BinlogStream.private_method_defined?(:_open)
+    format = @client.query("SELECT @@global.binlog_format AS f").first['f'] rescue nil
+    pending("needs binary logging with binlog_format=ROW") unless format == 'ROW' && @client.query("SHOW MASTER STATUS").first
+
+    @client.query "CREATE TABLE IF NOT EXISTS mysql2_binlog_test (id INT NOT NULL, name VARCHAR(16), amount DECIMAL(8,3), created_at DATETIME(3), big BIGINT UNSIGNED, small TINYINT UNSIGNED, PRIMARY KEY (id))"
+    @client.query "DELETE FROM mysql2_binlog_test"
+    status = @client.query("SHOW MASTER STATUS").first
+    @stream = Mysql2::BinlogStream.new :host => "localhost", :username => "root", :server_id => 4242,
+                                       :file => status['File'], :position => status['Position']
+  end
+
+  after(:each) do
+    @stream.close if @stream
+    @client.close
+  end
+
+  def next_event
+    Timeout.timeout(5) do
+      @stream.each { |event| return event if event[:table] == "mysql2_binlog_test" }
+    end
+  end
+
+  it "should decode inserted rows" do
+    @client.query "INSERT INTO mysql2_binlog_test VALUES (1, 'first', -12.5, '2026-10-18 12:34:56.789', 18446744073709551615, 255), (2, NULL, 0, NULL, NULL, NULL)"
+    event = next_event
+    event[:type].should eql(:insert)
+    event[:database].should eql('test')
+    event[:rows].size.should eql(2)
+    row = event[:rows].first
+    row['id'].should eql(1)
+    row['name'].should eql('first')
+    row['amount'].should eql(BigDecimal('-12.5'))
+    row['created_at'].should eql(Time.local(2026, 10, 18, 12, 34, 56, 789000))
+    row['big'].should eql(18446744073709551615)
+    row['small'].should eql(255)
+    event[:rows].last['name'].should be_nil
+  end
+
+  it "should give the rows before and after an update" do
+    @client.query "INSERT INTO mysql2_binlog_test (id, name) VALUES (1, 'before')"
+    @client.query "UPDATE mysql2_binlog_test SET name = 'after' WHERE id = 1"
+    next_event[:type].should eql(:insert)
+    event = next_event
+    event[:type].should eql(:update)
+    event[:rows].first[:before]['name'].should eql('before')
+    event[:rows].first[:after]['name'].should eql('after')
+  end
+
+  it "should decode deleted rows" do
+    @client.query "INSERT INTO mysql2_binlog_test (id) VALUES (3)"
+    @client.query "DELETE FROM mysql2_binlog_test WHERE id = 3"
+    next_event
+    event = next_event
+    event[:type].should eql(:delete)
+    event[:rows].first['id'].should eql(3)
+  end
+
+  it "should batch the events of a transaction" do
+    @client.query "BEGIN"
+    @client.query "INSERT INTO mysql2_binlog_test (id) VALUES (4)"
+    @client.query "INSERT INTO mysql2_binlog_test (id) VALUES (5)"
+    @client.query "COMMIT"
+    batch = Timeout.timeout(5) { @stream.each_batch { |events| break events } }
+    batch.map { |event| event[:rows].first['id'] }.should eql([4, 5])
+  end
+
+  it "should only move its position at the end of a transaction" do
+    start = @stream.position
+    @client.query "BEGIN"
+    3.times { |i| @client.query "INSERT INTO mysql2_binlog_test (id) VALUES (#{10 + i})" }
+    @client.query "COMMIT"
+    stream = Mysql2::BinlogStream.new :host => "localhost", :username => "root", :server_id => 4243,
+                                      :file => start[0], :position => start[1], :batch_size => 2
+    begin
+      first = Timeout.timeout(5) { stream.each_batch { |events| break events } }
+      first.size.should eql(2)
+      stream.position.should eql(start)
+      rest = Timeout.timeout(5) { stream.each_batch { |events| break events } }
+      rest.size.should eql(1)
+      stream.position.should_not eql(start)
+    ensure
+      stream.close
+    end
+  end
+
+  it "should need a :server_id" do
+    lambda {
+      Mysql2::BinlogStream.new :host => "localhost", :username => "root"
+    }.should raise_error(ArgumentError)
+  end
+end
@@ -167,6 +167,64 @@ describe Mysql2::Client do
         }.should raise_error(Mysql2::Error)
       end
 
+      it "should accept sub-second :read_timeout and :timeout" do
+        client = Mysql2::Client.new(:read_timeout => 0.2)
+        lambda {
+          client.query("SELECT sleep(1)")
+        }.should raise_error(Mysql2::Error, /waited 0.2 seconds/)
+
+        lambda {
+          @client.query("SELECT sleep(1)", :timeout => 0.1)
+        }.should raise_error(Mysql2::Error, /waited 0.1 seconds/)
+      end
+
+      it "should close the connection on timeout by default" do
+        lambda {
+          @client.query("SELECT sleep(1)", :timeout => 0.1)
+        }.should raise_error(Mysql2::Error)
+        lambda {
+          @client.query("SELECT 1")
+        }.should raise_error(Mysql2::Error)
+      end
+
+      it "should kill the query and keep the connection with :on_timeout => :cancel" do
+        client = Mysql2::Client.new(:on_timeout => :cancel)
+        lambda {
+          client.query("SELECT sleep(5)", :timeout => 0.1)
+        }.should raise_error(Mysql2::Error)
+        client.query("SELECT 1 AS one").first.should eql('one' => 1)
+        @client.query("SHOW PROCESSLIST").select { |row| row['Info'] == "SELECT sleep(5)" }.should be_empty
+      end
+
+      it "should cancel an async query" do
+        @client.query("SELECT sleep(5)", :async => true)
+        start = Time.now
+        @client.cancel
+        @client.async_result
+        (Time.now - start).should < 2
+        @client.query("SELECT 1 AS one").first.should eql('one' => 1)
+      end
+
+      it "should share one side connection for cancelling" do
+        other = Mysql2::Client.new
+        cancellers = []
+        [@client, @client, other].each do |client|
+          client.query("SELECT sleep(5)", :async => true)
+          client.cancel
+          client.async_result
+          cancellers << Mysql2::Client.send(:class_variable_get, :@@cancellers).values
+        end
+        cancellers.uniq.size.should eql(1)
+        other.close
+      end
+
+      it "should expect write_timeout to be a positive number" do
+        lambda {
+          Mysql2::Client.new(:write_timeout => -1)
+        }.should raise_error(Mysql2::Error)
+        Mysql2::Client.new(:write_timeout => 0.5).query("SELECT 1").first.should eql('1' => 1)
+      end
+
       # XXX this test is not deterministic (because Unix signal handling is not)
       # and may fail on a loaded system
       it "should run signal handlers while waiting for a response" do
@@ -269,6 +327,49 @@ describe Mysql2::Client do
       end
     end
     
+    context "wait_any and wait_all" do
+      before(:each) do
+        @slow_client = Mysql2::Client.new
+      end
+
+      after(:each) do
+        @slow_client.close
+      end
+
+      it "wait_any should return the clients that are ready first" do
+        @slow_client.query("SELECT sleep(0.5)", :async => true)
+        @client.query("SELECT 1", :async => true)
+        Mysql2::Client.wait_any([@slow_client, @client]).should eql([@client])
+        @client.async_result.first.should eql('1' => 1)
+        @slow_client.async_result
+      end
+
+      it "wait_all should wait for every client" do
+        @slow_client.query("SELECT sleep(0.1)", :async => true)
+        @client.query("SELECT 1", :async => true)
+        Mysql2::Client.wait_all([@slow_client, @client]).should eql([@slow_client, @client])
+        @slow_client.async_result.class.should eql(Mysql2::Result)
+        @client.async_result.class.should eql(Mysql2::Result)
+      end
+
+      it "should return an empty Array if the timeout expires" do
+        @slow_client.query("SELECT sleep(0.5)", :async => true)
+        Mysql2::Client.wait_any([@slow_client], 0.05).should eql([])
+        Mysql2::Client.wait_all([@slow_client, @client], 0.05).should eql([@client])
+        @slow_client.async_result
+      end
+
+      it "should count clients without a pending query as ready" do
+        Mysql2::Client.wait_any([@client]).should eql([@client])
+      end
+
+      it "should require Mysql2::Client instances" do
+        lambda {
+          Mysql2::Client.wait_any([1])
+        }.should raise_error(TypeError)
+      end
+    end
+
     context "Multiple results sets" do
       before(:each) do
         @multi_client = Mysql2::Client.new( :flags => Mysql2::Client::MULTI_STATEMENTS)
@@ -394,6 +495,25 @@ describe Mysql2::Client do
     info[:version].class.should eql(String)
   end
 
+  it "#info should include how long connecting took" do
+    @client.info[:connect_time].should be_kind_of(Float)
+    @client.info.should have_key(:ssl_cipher)
+  end
+
+  it "should not resume a TLS session under other TLS options" do
+    pending("needs an SSL connection and MySQL 8.0.29+ client libraries") unless @client.info[:ssl_cipher] && @client.info.key?(:ssl_session_reused)
+    # @client's session was set up with the default :ssl_mode
+    Mysql2::Client.new(:ssl_mode => :required).info[:ssl_session_reused].should be_false
+    Mysql2::Client.new(:ssl_mode => :required).info[:ssl_session_reused].should be_true
+  end
+
+  it "should reject an unknown :ssl_mode" do
+    pending("needs MySQL 5.7.11+ client libraries") if @client.info[:id] < 50711
+    lambda {
+      Mysql2::Client.new(:ssl_mode => :sometimes)
+    }.should raise_error(ArgumentError)
+  end
+
   if defined? Encoding
     context "strings returned by #info" do
       it "should default to the connection's encoding if Encoding.default_internal is nil" do
@@ -462,6 +582,369 @@ describe Mysql2::Client do
     }.should_not raise_error(Mysql2::Error)
   end
 
+  context "a server that never answers" do
+    before(:each) do
+      require 'socket'
+      # accepts connections but never sends the handshake
+      @server = TCPServer.new('127.0.0.1', 0)
+      @accepted = []
+      @acceptor = Thread.new { loop { @accepted << @server.accept } }
+    end
+
+    after(:each) do
+      @acceptor.kill
+      @accepted.each { |socket| socket.close }
+      @server.close
+    end
+
+    it "should let Timeout interrupt connecting" do
+      start = Time.now
+      lambda {
+        Timeout.timeout(0.5) do
+          Mysql2::Client.new(:host => '127.0.0.1', :port => @server.addr[1], :shutdown_on_interrupt => true)
+        end
+      }.should raise_error(Timeout::Error)
+      (Time.now - start).should < 2
+    end
+
+    it "should let Thread#kill stop a thread that's connecting" do
+      thread = Thread.new { Mysql2::Client.new(:host => '127.0.0.1', :port => @server.addr[1], :shutdown_on_interrupt => true) }
+      sleep 0.2
+      thread.kill
+      thread.join(2).should_not be_nil
+      thread.alive?.should be_false
+    end
+  end
+
+  it "should keep the connection when a trapped signal arrives during a query" do
+    received = false
+    trap(:USR1) { received = true }
+    begin
+      # the row is sent after the column definitions, so this signal comes
+      # while libmysql is blocked reading it
+      pid = fork do
+        sleep 0.5
+        Process.kill(:USR1, Process.ppid)
+      end
+      @client.query("SELECT SLEEP(1) AS slept").first['slept'].should eql(0)
+      Process.waitpid(pid)
+      received.should be_true
+      @client.query("SELECT 1 AS one").first['one'].should eql(1)
+    ensure
+      trap(:USR1, 'DEFAULT')
+    end
+  end
+
+  context "compression" do
+    it "should not compress by default" do
+      @client.compression_stats[:compression].should be_false
+      @client.compression_stats[:algorithm].should be_nil
+    end
+
+    it "should leave the client's query options alone" do
+      @client.compression_stats
+      @client.query("SELECT 1 AS one").first.should eql('one' => 1)
+    end
+
+    it "should compress with :compress => true" do
+      client = Mysql2::Client.new(:compress => true)
+      stats = client.compression_stats
+      stats[:compression].should be_true
+      stats[:algorithm].should eql('zlib')
+      client.query("SELECT REPEAT('a', 1024) AS a").first['a'].should eql('a' * 1024)
+    end
+
+    it "should send fewer bytes for compressible results" do
+      sent = lambda do |client|
+        before = client.compression_stats[:bytes_sent]
+        client.query("SELECT REPEAT('compressible ', 100000) AS a").first
+        client.compression_stats[:bytes_sent] - before
+      end
+      sent.call(Mysql2::Client.new(:compress => true)).should < sent.call(@client) / 10
+    end
+  end
+
+  context "after a fork" do
+    it "should leave the parent's connection alone when the child closes the client" do
+      pid = fork do
+        @client.close
+        exit!(0)
+      end
+      Process.waitpid(pid)
+      @client.query("SELECT 1 AS one").first.should eql('one' => 1)
+    end
+
+    it "should reconnect in the child on first use" do
+      parent_id = @client.query("SELECT CONNECTION_ID() AS id").first['id']
+      rd, wr = IO.pipe
+      pid = fork do
+        rd.close
+        wr.write(@client.query("SELECT CONNECTION_ID() AS id").first['id'].to_s)
+        wr.close
+        exit!(0)
+      end
+      wr.close
+      child_id = rd.read.to_i
+      Process.waitpid(pid)
+      child_id.should_not eql(0)
+      child_id.should_not eql(parent_id)
+      @client.query("SELECT CONNECTION_ID() AS id").first['id'].should eql(parent_id)
+    end
+  end
+
+  context ":retry_reads" do
+    before(:each) do
+      @retrying = Mysql2::Client.new(:retry_reads => true, :retry_backoff => 0.01)
+    end
+
+    def kill_connection(client)
+      @client.query("KILL #{client.thread_id}")
+    end
+
+    it "should reconnect and retry a read that lost its connection" do
+      kill_connection(@retrying)
+      @retrying.query("SELECT 1 AS one").first.should eql('one' => 1)
+      @retrying.reconnect_stats[:reconnects].should eql(1)
+      @retrying.reconnect_stats[:retries].should eql(1)
+    end
+
+    it "should restore the database and session variables" do
+      @retrying.query("SET @mysql2_marker = 42")
+      @retrying.query("SET SESSION sql_mode = 'ANSI_QUOTES'")
+      @retrying.select_db("information_schema")
+      kill_connection(@retrying)
+      row = @retrying.query("SELECT @mysql2_marker AS marker, @@SESSION.sql_mode AS sql_mode, DATABASE() AS db").first
+      row.should eql('marker' => 42, 'sql_mode' => 'ANSI_QUOTES', 'db' => 'information_schema')
+    end
+
+    it "should restore the latest value of a variable set several times" do
+      @retrying.query("SET @mysql2_marker = 1")
+      @retrying.query("SET @mysql2_marker = 2")
+      @retrying.query("SET @mysql2_marker = 1")
+      kill_connection(@retrying)
+      @retrying.query("SELECT @mysql2_marker AS marker").first['marker'].should eql(1)
+    end
+
+    it "should raise instead of crashing when a closed client is asked for more results" do
+      client = Mysql2::Client.new :host => "localhost", :username => "root"
+      client.close
+      lambda { client.more_results }.should raise_error(Mysql2::Error)
+      lambda { client.next_result }.should raise_error(Mysql2::Error)
+      lambda { client.store_result }.should raise_error(Mysql2::Error)
+    end
+
+    it "should not retry writes, but leave a working connection" do
+      kill_connection(@retrying)
+      lambda {
+        @retrying.query("DO 1")
+      }.should raise_error(Mysql2::Error)
+      @retrying.reconnect_stats[:retries].should eql(0)
+      @retrying.query("SELECT 1 AS one").first.should eql('one' => 1)
+    end
+
+    it "should not retry locking reads" do
+      kill_connection(@retrying)
+      lambda {
+        @retrying.query("SELECT 1 FROM DUAL FOR SHARE SKIP LOCKED")
+      }.should raise_error(Mysql2::Error)
+      @retrying.reconnect_stats[:retries].should eql(0)
+    end
+
+    it "should not retry reads inside a transaction" do
+      @retrying.query("BEGIN")
+      @retrying.query("SELECT 1")
+      @retrying.in_transaction?.should be_true
+      kill_connection(@retrying)
+      lambda {
+        @retrying.query("SELECT 1")
+      }.should raise_error(Mysql2::Error)
+      @retrying.in_transaction?.should be_false
+    end
+
+    it "should give up after :retry_attempts failed reconnects" do
+      client = Mysql2::Client.new(:retry_reads => true, :retry_attempts => 2, :retry_backoff => 0.01)
+      client.instance_variable_set(:@connect_options, :host => '127.0.0.1', :port => 1)
+      kill_connection(client)
+      lambda {
+        client.query("SELECT 1")
+      }.should raise_error(Mysql2::Error)
+      client.reconnect_stats[:failed_reconnects].should eql(3)
+    end
+  end
+
+  context "connect_many" do
+    it "should return that many connected clients" do
+      clients = Mysql2::Client.connect_many(3)
+      clients.size.should eql(3)
+      clients.each { |client| client.ping.should be_true }
+      clients.map { |client| client.thread_id }.uniq.size.should eql(3)
+      clients.each { |client| client.close }
+    end
+
+    it "should raise if any of the connections fails" do
+      lambda {
+        Mysql2::Client.connect_many(2, :host => "localhost", :username => 'asdfasdf8d2h', :password => 'asdfasdfw42')
+      }.should raise_error(Mysql2::Error)
+    end
+  end
+
+  context "each_batch" do
+    before(:each) do
+      @client.query "CREATE TEMPORARY TABLE IF NOT EXISTS batch_rows (id INT NOT NULL, name VARCHAR(20), PRIMARY KEY (id))"
+      @client.query "DELETE FROM batch_rows"
+      @client.query "INSERT INTO batch_rows VALUES #{(1..25).map { |i| "(#{i * 3}, 'row #{i}')" }.join(',')}"
+    end
+
+    it "should yield every row once, in key order, in batches" do
+      sizes, ids = [], []
+      @client.each_batch("SELECT * FROM batch_rows", :key => "id", :batch_size => 10) do |result|
+        sizes << result.count
+        result.each { |row| ids << row['id'] }
+      end
+      sizes.should eql([10, 10, 5])
+      ids.should eql((1..25).map { |i| i * 3 })
+    end
+
+    it "should keep the :where condition" do
+      ids = []
+      @client.each_batch("SELECT id FROM batch_rows", :where => "id < 30 OR id > 70", :key => "id", :batch_size => 4, :as => :array) do |result|
+        result.each { |row| ids << row.first }
+      end
+      ids.should eql([3, 6, 9, 12, 15, 18, 21, 24, 27, 72, 75])
+    end
+
+    it "should reject a template with a WHERE of its own" do
+      lambda {
+        @client.each_batch("SELECT id FROM batch_rows WHERE id > (SELECT MIN(id) FROM batch_rows WHERE id > 3)", :key => "id") { |result| }
+      }.should raise_error(ArgumentError)
+    end
+
+    it "should allow WHERE inside a string literal" do
+      count = 0
+      @client.each_batch("SELECT id, 'WHERE' AS word FROM batch_rows", :key => "id", :batch_size => 10) do |result|
+        count += result.count
+      end
+      count.should eql(25)
+    end
+
+    it "should page on a key with fractional seconds" do
+      @client.query "CREATE TEMPORARY TABLE IF NOT EXISTS batch_times (at DATETIME(6) NOT NULL, PRIMARY KEY (at))"
+      @client.query "DELETE FROM batch_times"
+      @client.query "INSERT INTO batch_times VALUES ('2026-01-01 00:00:00.250000'), ('2026-01-01 00:00:00.500000'), ('2026-01-01 00:00:00.750000')"
+      count = 0
+      @client.each_batch("SELECT at FROM batch_times", :key => "at", :batch_size => 1) do |result|
+        count += result.count
+      end
+      count.should eql(3)
+    end
+
+    it "should write a time key in the :database_timezone" do
+      client = Mysql2::Client.new(:database_timezone => :utc)
+      client.send(:keyset_literal, Time.new(2026, 1, 1, 5, 0, 0, "+05:00")).should eql("'2026-01-01 00:00:00.000000'")
+      client.send(:keyset_literal, DateTime.new(2026, 1, 1, 5, 0, 0, "+05:00")).should eql("'2026-01-01 00:00:00.000000'")
+      client.close
+    end
+
+    it "should leave the client usable after breaking out with a batch in flight" do
+      @client.each_batch("SELECT * FROM batch_rows", :key => "id", :batch_size => 5) { |result| break }
+      @client.query("SELECT COUNT(*) AS c FROM batch_rows").first['c'].should eql(25)
+    end
+
+    it "should require a key" do
+      lambda {
+        @client.each_batch("SELECT * FROM batch_rows", :batch_size => 5) { |result| }
+      }.should raise_error(ArgumentError)
+    end
+  end
+
+  context "result cache" do
+    before(:each) do
+      Mysql2::Client.clear_result_cache
+      @client.query "CREATE TEMPORARY TABLE IF NOT EXISTS cached_rows (id INT, name VARCHAR(20))"
+      @client.query "DELETE FROM cached_rows"
+      @client.query "INSERT INTO cached_rows VALUES (1, 'one'), (2, 'two')"
+    end
+
+    it "should answer a repeated query from the cache until it's invalidated" do
+      @client.query("SELECT * FROM cached_rows", :cache => 60).count.should eql(2)
+      @client.query "INSERT INTO cached_rows VALUES (3, 'three')"
+      @client.query("SELECT * FROM cached_rows", :cache => 60).count.should eql(2)
+      @client.invalidate("cached_rows").should eql(1)
+      @client.query("SELECT * FROM cached_rows", :cache => 60).count.should eql(3)
+
+      stats = Mysql2::Client.result_cache_stats
+      stats[:hits].should eql(1)
+      stats[:misses].should eql(2)
+      stats[:invalidations].should eql(1)
+    end
+
+    it "should only cache the queries given :cache" do
+      @client.query("SELECT * FROM cached_rows", :cache => 60).count.should eql(2)
+      @client.query_options.should_not have_key(:cache)
+      @client.query "INSERT INTO cached_rows VALUES (3, 'three')"
+      @client.query("SELECT * FROM cached_rows").count.should eql(3)
+      @client.query("SELECT * FROM cached_rows", :as => :array).count.should eql(3)
+    end
+
+    it "should cast cached rows with each query's own options" do
+      @client.query("SELECT * FROM cached_rows ORDER BY id", :cache => 60).first.should eql('id' => 1, 'name' => 'one')
+      @client.query("SELECT * FROM cached_rows ORDER BY id", :cache => 60, :as => :array, :cast => false).to_a.should eql([['1', 'one'], ['2', 'two']])
+    end
+
+    it "should let several results read the same cached rows" do
+      first = @client.query("SELECT * FROM cached_rows ORDER BY id", :cache => 60)
+      second = @client.query("SELECT * FROM cached_rows ORDER BY id", :cache => 60)
+      Mysql2::Client.clear_result_cache
+      first.each_with_index do |row, i|
+        second.to_a[i].should eql(row)
+      end
+    end
+
+    it "should expire entries after their ttl" do
+      @client.query("SELECT * FROM cached_rows", :cache => 0.1)
+      sleep 0.2
+      @client.query("SELECT * FROM cached_rows", :cache => 0.1)
+      Mysql2::Client.result_cache_stats[:expirations].should eql(1)
+    end
+
+    it "should not hand results that depend on session state to other connections" do
+      other = Mysql2::Client.new :host => "localhost", :username => "root", :database => 'test'
+      begin
+        other.query "CREATE TEMPORARY TABLE IF NOT EXISTS cached_rows (id INT, name VARCHAR(20))"
+        other.query "INSERT INTO cached_rows VALUES (9, 'nine')"
+        @client.query("SELECT * FROM cached_rows ORDER BY id", :cache => 60).first['id'].should eql(1)
+        other.query("SELECT * FROM cached_rows ORDER BY id", :cache => 60).first['id'].should eql(9)
+
+        @client.query "SET time_zone = '+03:21'"
+        @client.query("SELECT @@time_zone AS tz", :cache => 60).first['tz'].should eql('+03:21')
+        other.query("SELECT @@time_zone AS tz", :cache => 60).first['tz'].should_not eql('+03:21')
+      ensure
+        other.close
+      end
+    end
+
+    it "should not cache inside a transaction" do
+      @client.query "BEGIN"
+      @client.query "INSERT INTO cached_rows VALUES (3, 'three')"
+      @client.query("SELECT * FROM cached_rows", :cache => 60).count.should eql(3)
+      @client.query "ROLLBACK"
+      @client.query("SELECT * FROM cached_rows", :cache => 60).count.should eql(2)
+    end
+
+    it "should evict the least recently used results to stay within the budget" do
+      budget = Mysql2::Client.result_cache_budget
+      begin
+        Mysql2::Client.result_cache_budget = 64 * 1024
+        3.times { |i| @client.query("SELECT REPEAT('x', 30000) AS c#{i}", :cache => 60) }
+        stats = Mysql2::Client.result_cache_stats
+        stats[:evictions].should > 0
+        stats[:bytes].should <= 64 * 1024
+      ensure
+        Mysql2::Client.result_cache_budget = budget
+      end
+    end
+  end
+
   context 'write operations api' do
     before(:each) do
       @client.query "USE test"
@@ -552,6 +1035,26 @@ describe Mysql2::Client do
     @client.ping.should eql(false)
   end
 
+  context "ObjectSpace.memsize_of" do
+    before(:each) do
+      require 'objspace'
+      pending("ObjectSpace.memsize_of isn't available on this ruby") unless ObjectSpace.respond_to?(:memsize_of)
+    end
+
+    it "should include the connection's buffers" do
+      ObjectSpace.memsize_of(@client).should > 0
+      memsize = ObjectSpace.memsize_of(@client)
+      @client.close
+      ObjectSpace.memsize_of(@client).should < memsize
+    end
+
+    it "should include the rows of a stored result" do
+      small = @client.query("SELECT 1")
+      large = @client.query("SELECT REPEAT('x', 65536) UNION ALL SELECT REPEAT('y', 65536)")
+      ObjectSpace.memsize_of(large).should > ObjectSpace.memsize_of(small) + 2 * 65536
+    end
+  end
+
 if RUBY_VERSION =~ /1.9/
   it "should respond to #encoding" do
     @client.should respond_to(:encoding)
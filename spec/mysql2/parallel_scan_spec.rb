@@ -0,0 +1,65 @@
+# encoding: UTF-8
+require 'spec_helper'
+
+describe Mysql2::ParallelScan do
+  before(:all) do
+    client = Mysql2::Client.new :host => "localhost", :username => "root", :database => 'test'
+    client.query "CREATE TABLE IF NOT EXISTS mysql2_scan_test (id INT NOT NULL, value VARCHAR(16), PRIMARY KEY (id))"
+    client.query "DELETE FROM mysql2_scan_test"
+    values = (1..250).map { |i| "(#{i * 2}, 'row #{i}')" }
+    client.query "INSERT INTO mysql2_scan_test VALUES #{values.join(',')}"
+    client.close
+  end
+
+  before(:each) do
+    @clients = Array.new(3) { Mysql2::Client.new :host => "localhost", :username => "root", :database => 'test' }
+  end
+
+  after(:each) do
+    @clients.each { |client| client.close }
+  end
+
+  it "should split the key range into chunks" do
+    scan = Mysql2::ParallelScan.new(@clients, "mysql2_scan_test", "id", 100)
+    scan.chunks.should eql([[2, 102], [102, 202], [202, 302], [302, 402], [402, 502]])
+  end
+
+  it "should yield every row in key order" do
+    scan = Mysql2::ParallelScan.new(@clients, "mysql2_scan_test", "id", 64, :batch_size => 10)
+    scan.map { |row| row['id'] }.should eql((1..250).map { |i| i * 2 })
+  end
+
+  it "should yield every row once when unordered" do
+    scan = Mysql2::ParallelScan.new(@clients, "mysql2_scan_test", "id", 64, :ordered => false)
+    scan.map { |row| row['id'] }.sort.should eql((1..250).map { |i| i * 2 })
+  end
+
+  it "should report each chunk's throughput" do
+    reported = []
+    scan = Mysql2::ParallelScan.new(@clients, "mysql2_scan_test", "id", 100, :on_chunk => lambda { |stats| reported << stats[:chunk] })
+    scan.each_batch { |rows| }
+    reported.should eql([0, 1, 2, 3, 4])
+    scan.chunk_stats.map { |stats| stats[:rows] }.inject(0) { |sum, rows| sum + rows }.should eql(250)
+    scan.chunk_stats.each { |stats| stats[:seconds].should >= 0 }
+  end
+
+  it "should leave the clients usable after the block breaks out" do
+    scan = Mysql2::ParallelScan.new(@clients, "mysql2_scan_test", "id", 20, :batch_size => 1)
+    scan.each { |row| break }
+    @clients.each { |client| client.query("SELECT 1 AS one").first['one'].should eql(1) }
+  end
+
+  it "should leave the clients' query options as they were" do
+    Mysql2::ParallelScan.new(@clients, "mysql2_scan_test", "id", 100).each { |row| }
+    @clients.each do |client|
+      client.query_options[:stream].should be_false
+      client.query_options[:as].should eql(:hash)
+      client.query("SELECT 1 AS one").first.should eql('one' => 1)
+    end
+  end
+
+  it "should raise errors from the clients' threads" do
+    scan = Mysql2::ParallelScan.new(@clients, "mysql2_scan_test", "id", 100, :columns => "no_such_column")
+    lambda { scan.each { |row| } }.should raise_error(Mysql2::Error)
+  end
+end
@@ -94,6 +94,59 @@ describe Mysql2::Result do
       end
     end
 
+    it "should fill a Struct's members from the fields of the same name" do
+      klass = Struct.new(:b, :missing, :a)
+      row = @client.query("SELECT 1 AS a, 'two' AS b, NULL AS c", :as => klass).first
+      row.should be_an_instance_of(klass)
+      row.a.should eql(1)
+      row.b.should eql('two')
+      row.missing.should be_nil
+    end
+
+    it "should only build the fields named in :columns, in that order" do
+      result = @client.query("SELECT 1 AS a, 'two' AS b, 3 AS c")
+      result.each(:columns => ['c', :a], :cache_rows => false) do |row|
+        row.should eql('c' => 3, 'a' => 1)
+        row.keys.should eql(['c', 'a'])
+      end
+      result.each(:columns => ['b'], :as => :array, :cache_rows => false) do |row|
+        row.should eql(['two'])
+      end
+    end
+
+    it "should leave out the fields named in :skip_columns" do
+      @client.query("SELECT 1 AS a, 'two' AS b, 3 AS c", :skip_columns => ['b', 'missing']).first.should eql('a' => 1, 'c' => 3)
+    end
+
+    it "should pass only the fields :columns picks to an :as class" do
+      klass = Class.new { attr_reader :args; def initialize(*args) @args = args end }
+      result = @client.query("SELECT 1 AS a, 'two' AS b, 3 AS c")
+      result.each(:as => klass, :columns => ['c', 'a'], :cache_rows => false) do |row|
+        row.args.should eql([3, 1])
+      end
+      result.each(:as => klass, :skip_columns => ['a'], :cache_rows => false) do |row|
+        row.args.should eql(['two', 3])
+      end
+    end
+
+    it "should raise for a name in :columns that isn't a field" do
+      lambda {
+        @client.query("SELECT 1 AS a", :columns => ['b']).first
+      }.should raise_error(ArgumentError)
+    end
+
+    it "should pass the fields in order to any other class" do
+      klass = Class.new do
+        attr_reader :values
+        def initialize(*values)
+          @values = values
+        end
+      end
+      @client.query("SELECT 1 AS a, 'two' AS b, NULL AS c").each(:as => klass) do |row|
+        row.values.should eql([1, 'two', nil])
+      end
+    end
+
     it "should cache previously yielded results by default" do
       @result.first.object_id.should eql(@result.first.object_id)
     end
@@ -121,6 +174,165 @@ describe Mysql2::Result do
         result.each {}
       }.to raise_exception(Mysql2::Error)
     end
+
+    context "with :prefetch" do
+      it "should yield the same rows as without it" do
+        sql = "SELECT id, int_test, decimal_test, date_time_test, char_test, null_test FROM mysql2_test"
+        prefetched = @client.query(sql, :stream => true, :prefetch => 4).to_a
+        prefetched.should eql(@client.query(sql, :stream => true).to_a)
+      end
+
+      it "should read more rows than fit in the buffer" do
+        sql = (1..50).map { |i| "SELECT #{i} AS n" }.join(" UNION ALL ")
+        @client.query(sql, :stream => true, :prefetch => 3).map { |row| row['n'] }.should eql((1..50).to_a)
+      end
+
+      it "should pick up after the rows already read when the block breaks out" do
+        result = @client.query "SELECT 1 AS n UNION SELECT 2 UNION SELECT 3", :stream => true, :cache_rows => false, :prefetch => 8
+        result.first.should eql('n' => 1)
+        result.map { |row| row['n'] }.should eql([2, 3])
+      end
+    end
+
+    context "with :spill" do
+      before(:each) do
+        @sql = (1..200).map { |i| "SELECT #{i} AS n, REPEAT('x', #{i}) AS s, #{i % 3 == 0 ? 'NULL' : "'v'"} AS v" }.join(" UNION ALL ")
+      end
+
+      it "should yield the same rows as a stored result" do
+        @client.query(@sql, :spill => true).to_a.should eql(@client.query(@sql).to_a)
+      end
+
+      it "should free the connection before the rows are read" do
+        result = @client.query(@sql, :spill => true, :cache_rows => false)
+        @client.query("SELECT 1 AS one").first.should eql('one' => 1)
+        result.count.should eql(200)
+        result.map { |row| row['n'] }.should eql((1..200).to_a)
+      end
+
+      it "should be possible to iterate more than once without caching rows" do
+        result = @client.query(@sql, :spill => true, :cache_rows => false)
+        result.map { |row| row['n'] }.should eql(result.map { |row| row['n'] })
+      end
+
+      it "should look up rows by index" do
+        result = @client.query(@sql, :spill => true, :cache_rows => false)
+        result[0].should eql('n' => 1, 's' => 'x', 'v' => 'v')
+        result[130]['n'].should eql(131)
+        result[2]['v'].should be_nil
+        result[-1]['s'].should eql('x' * 200)
+        result[200].should be_nil
+      end
+
+      it "should put the file in the given directory" do
+        @client.query(@sql, :spill => Dir.pwd).count.should eql(200)
+      end
+    end
+  end
+
+  context ":casters" do
+    it "should parse JSON fields named in :casters" do
+      row = @client.query(%q{SELECT '{"a": [1, 2]}' AS payload, '{"a": 1}' AS other}, :casters => { 'payload' => :json }).first
+      row['payload'].should eql('a' => [1, 2])
+      row['other'].should eql('{"a": 1}')
+    end
+
+    it "should cast fields to booleans by name" do
+      row = @client.query("SELECT 0 AS off, 2 AS on_, 0 AS untouched", :casters => { 'off' => :boolean, 'on_' => :boolean }).first
+      row.should eql('off' => false, 'on_' => true, 'untouched' => 0)
+    end
+
+    it "should apply a caster to every UNSIGNED integer field" do
+      row = @client.query("SELECT CAST(18446744073709551615 AS UNSIGNED) AS big, -1 AS signed_", :casters => { :unsigned => :unsigned }).first
+      row['big'].should eql(18446744073709551615)
+      row['signed_'].should eql(-1)
+    end
+
+    it "should format binary UUIDs" do
+      row = @client.query("SELECT UNHEX('6ccd780cbaba102695645b8c656024db') AS id", :casters => { 'id' => :uuid }).first
+      row['id'].should eql('6ccd780c-baba-1026-9564-5b8c656024db')
+    end
+
+    it "should match fields by column type" do
+      @client.query("SELECT 'abc' AS s, 1 AS n", :casters => { :varchar => :string, :bigint => :string, :int => :string }).first.should eql('s' => 'abc', 'n' => '1')
+    end
+
+    it "should call anything that responds to call with the String" do
+      row = @client.query("SELECT 'abc' AS s", :casters => { 's' => lambda { |value| value.upcase } }).first
+      row['s'].should eql('ABC')
+    end
+
+    it "should leave NULL fields nil" do
+      @client.query("SELECT NULL AS payload", :casters => { 'payload' => :json }).first['payload'].should be_nil
+    end
+
+    it "should raise for an unknown caster" do
+      lambda {
+        @client.query("SELECT 1 AS n", :casters => { 'n' => :nope }).first
+      }.should raise_error(ArgumentError)
+    end
+  end
+
+  context "random access" do
+    before(:each) do
+      @sql = (1..100).map { |i| "SELECT #{i} AS n" }.join(" UNION ALL ")
+    end
+
+    it "should return the row at an index" do
+      result = @client.query(@sql)
+      result[0].should eql('n' => 1)
+      result[42].should eql('n' => 43)
+      result[-1].should eql('n' => 100)
+      result[100].should be_nil
+      result[-101].should be_nil
+    end
+
+    it "should return a range of rows" do
+      result = @client.query(@sql)
+      result.slice(10, 3).map { |row| row['n'] }.should eql([11, 12, 13])
+      result.slice(98, 10).map { |row| row['n'] }.should eql([99, 100])
+      result.slice(-2, 2).map { |row| row['n'] }.should eql([99, 100])
+      result.slice(100, 1).should eql([])
+      result.slice(101, 1).should be_nil
+    end
+
+    it "should return the first rows" do
+      result = @client.query(@sql, :cache_rows => false)
+      result.first.should eql('n' => 1)
+      result.first(3).map { |row| row['n'] }.should eql([1, 2, 3])
+      lambda { result.first(-1) }.should raise_error(ArgumentError)
+    end
+
+    it "should not move #each along" do
+      result = @client.query(@sql, :cache_rows => false)
+      result[50]
+      result.first(5)
+      result.map { |row| row['n'] }.should eql((1..100).to_a)
+    end
+
+    it "should hand out the same rows as #each when caching rows" do
+      result = @client.query(@sql)
+      row = result[60]
+      first = result.first
+      rows = result.to_a
+      rows[60].should equal(row)
+      rows[0].should equal(first)
+      rows.map { |r| r['n'] }.should eql((1..100).to_a)
+      result[60].should equal(row)
+    end
+
+    it "should read rows cached by #each after the result has been freed" do
+      result = @client.query(@sql)
+      rows = result.to_a
+      result[99].should equal(rows[99])
+    end
+
+    it "should raise on a streamed result" do
+      result = @client.query(@sql, :stream => true, :cache_rows => false)
+      lambda { result.slice(1, 2) }.should raise_error(Mysql2::Error)
+      result.first.should eql('n' => 1)
+      result.each { }
+    end
   end
 
   context "#fields" do
@@ -137,6 +349,13 @@ describe Mysql2::Result do
       result = @client.query "SELECT 'a', 'b', 'c'"
       result.fields.should eql(['a', 'b', 'c'])
     end
+
+    it "should still know the fields of an empty result after reading it" do
+      result = @client.query "SELECT 1 AS a, 2 AS b FROM DUAL WHERE 1 = 0"
+      result.to_a.should eql([])
+      result.to_a.should eql([])
+      result.fields.should eql(['a', 'b'])
+    end
   end
 
   context "row data type mapping" do
@@ -218,6 +437,42 @@ describe Mysql2::Result do
       @test_result['decimal_test'].should eql(10.3)
     end
 
+    context ":decimal_as" do
+      it "should return Float for a DECIMAL value if :decimal_as is :float" do
+        result = @client.query("SELECT decimal_test, decimal_zero_test FROM mysql2_test ORDER BY id DESC LIMIT 1", :decimal_as => :float).first
+        result['decimal_test'].class.should eql(Float)
+        result['decimal_test'].should eql(10.3)
+        result['decimal_zero_test'].should eql(0.0)
+      end
+
+      it "should return Rational for a DECIMAL value if :decimal_as is :rational" do
+        result = @client.query("SELECT decimal_test, decimal_zero_test FROM mysql2_test ORDER BY id DESC LIMIT 1", :decimal_as => :rational).first
+        result['decimal_test'].class.should eql(Rational)
+        result['decimal_test'].should eql(Rational(103, 10))
+        result['decimal_zero_test'].should eql(Rational(0, 1))
+      end
+
+      it "should return a scaled Integer for a DECIMAL value if :decimal_as is :scaled_int" do
+        result = @client.query("SELECT decimal_test, decimal_zero_test FROM mysql2_test ORDER BY id DESC LIMIT 1", :decimal_as => :scaled_int).first
+        result['decimal_test'].should eql(10300)
+        result['decimal_zero_test'].should eql(0)
+      end
+
+      it "should handle negative DECIMAL values" do
+        result = @client.query("SELECT CAST(-12.5 AS DECIMAL(10,3)) AS d", :decimal_as => :scaled_int).first
+        result['d'].should eql(-12500)
+        result = @client.query("SELECT CAST(-12.5 AS DECIMAL(10,3)) AS d", :decimal_as => :rational).first
+        result['d'].should eql(Rational(-25, 2))
+      end
+
+      it "should fall back to BigDecimal for DECIMAL values that don't fit into 64 bits" do
+        result = @client.query("SELECT CAST('12345678901234567890.5' AS DECIMAL(30,1)) AS d", :decimal_as => :scaled_int).first
+        result['d'].should eql(123456789012345678905)
+        result = @client.query("SELECT CAST('12345678901234567890.5' AS DECIMAL(30,1)) AS d", :decimal_as => :rational).first
+        result['d'].should eql(Rational(24691357802469135781, 2))
+      end
+    end
+
     it "should return Float for a FLOAT value" do
       @test_result['float_test'].class.should eql(Float)
       @test_result['float_test'].should eql(10.3)
@@ -324,6 +579,68 @@ describe Mysql2::Result do
       end
     end
 
+    context ":intern" do
+      it "should return the same frozen String for repeated ENUM and SET values" do
+        result = @client.query("SELECT enum_test, set_test FROM mysql2_test UNION ALL SELECT enum_test, set_test FROM mysql2_test", :intern => true).to_a
+        result[0]['enum_test'].should eql('val1')
+        result[0]['enum_test'].should be_frozen
+        result[0]['enum_test'].object_id.should eql(result[1]['enum_test'].object_id)
+        result[0]['set_test'].object_id.should eql(result[1]['set_test'].object_id)
+      end
+
+      it "should intern the columns named in an array" do
+        result = @client.query("SELECT char_test, varchar_test FROM mysql2_test UNION ALL SELECT char_test, varchar_test FROM mysql2_test", :intern => ['char_test']).to_a
+        result[0]['char_test'].object_id.should eql(result[1]['char_test'].object_id)
+        result[0]['varchar_test'].object_id.should_not eql(result[1]['varchar_test'].object_id)
+      end
+
+      it "should not intern anything by default" do
+        result = @client.query("SELECT enum_test FROM mysql2_test UNION ALL SELECT enum_test FROM mysql2_test").to_a
+        result[0]['enum_test'].object_id.should_not eql(result[1]['enum_test'].object_id)
+        result[0]['enum_test'].should_not be_frozen
+      end
+    end
+
+    it "should return frozen Strings if :freeze_strings is enabled" do
+      result = @client.query("SELECT char_test, blob_test, int_test FROM mysql2_test ORDER BY id DESC LIMIT 1", :freeze_strings => true).first
+      result['char_test'].should be_frozen
+      result['blob_test'].should be_frozen
+      result['int_test'].should eql(10)
+    end
+
+    context ":decode_threads" do
+      it "should cast the same values as decoding on the calling thread" do
+        sql = "SELECT * FROM mysql2_test ORDER BY id DESC LIMIT 1"
+        @client.query(sql, :decode_threads => 4).first.should eql(@client.query(sql).first)
+      end
+
+      it "should decode results larger than a single batch" do
+        # 10000 rows, a batch is 8192 (MYSQL2_DECODE_BATCH_ROWS in result.c)
+        digits = "(SELECT 0 AS id UNION SELECT 1 UNION SELECT 2 UNION SELECT 3 UNION SELECT 4 " +
+                 "UNION SELECT 5 UNION SELECT 6 UNION SELECT 7 UNION SELECT 8 UNION SELECT 9)"
+        sql = "SELECT a.id * 1000 + b.id * 100 + c.id * 10 + d.id AS n, 1.5 AS f, " +
+              "CAST('2010-10-30 12:30:45' AS DATETIME) AS d " +
+              "FROM #{digits} a, #{digits} b, #{digits} c, #{digits} d ORDER BY n"
+        rows = @client.query(sql, :decode_threads => 2).to_a
+        rows.size.should eql(10000)
+        rows.map { |row| row['n'] }.should eql((0...10000).to_a)
+        rows.last['d'].should eql(Time.local(2010, 10, 30, 12, 30, 45))
+      end
+
+      it "should pick up where a broken #each left off" do
+        sql = "SELECT id FROM mysql2_test ORDER BY id"
+        result = @client.query(sql, :decode_threads => 2)
+        result.each { break }
+        ids = []
+        result.each { |row| ids << row['id'] }
+        ids.should eql(@client.query(sql).map { |row| row['id'] })
+      end
+
+      it "should be ignored for unsigned BIGINTs that don't fit in 64 bits signed" do
+        @client.query("SELECT CAST(18446744073709551615 AS UNSIGNED) AS n", :decode_threads => 2).first['n'].should eql(18446744073709551615)
+      end
+    end
+
     it "should return String for a SET value" do
       @test_result['set_test'].class.should eql(String)
       @test_result['set_test'].should eql('val1,val2')
@@ -0,0 +1,81 @@
+# encoding: UTF-8
+require 'spec_helper'
+
+# Routes to the same server unless MYSQL2_REPLICA_PORT points at a second
+# mysqld, which is what the replica connections use then.
+describe Mysql2::RoutingClient do
+  before(:each) do
+    replica = { :host => "127.0.0.1", :port => (ENV['MYSQL2_REPLICA_PORT'] || 3306).to_i }
+    @client = Mysql2::RoutingClient.new(:username => "root", :database => "test",
+                                        :primary => {}, :replicas => [replica], :pin_after_write => 0.2)
+    @client.query "CREATE TABLE IF NOT EXISTS mysql2_routing_test (id INT)"
+    @client.query "DELETE FROM mysql2_routing_test"
+    sleep 0.3
+  end
+
+  after(:each) do
+    @client.close
+  end
+
+  it "should send reads to a replica and writes to the primary" do
+    primary_queries = @client.stats[:primary][:queries]
+    @client.query("SELECT 1")
+    @client.stats[:replicas].first[:queries].should eql(1)
+    @client.stats[:primary][:queries].should eql(primary_queries)
+  end
+
+  it "should keep locking reads on the primary" do
+    @client.read?("SELECT * FROM mysql2_routing_test FOR UPDATE").should be_false
+    @client.read?("SELECT * FROM mysql2_routing_test FOR SHARE").should be_false
+    @client.read?("SELECT * FROM mysql2_routing_test FOR UPDATE SKIP LOCKED").should be_false
+    @client.read?("SELECT * FROM mysql2_routing_test FOR SHARE NOWAIT").should be_false
+    @client.read?("SELECT * FROM mysql2_routing_test").should be_true
+    @client.read?("INSERT INTO mysql2_routing_test VALUES (1)").should be_false
+  end
+
+  it "should pin the thread to the primary for a while after a write" do
+    @client.query "INSERT INTO mysql2_routing_test VALUES (1)"
+    @client.pinned?.should be_true
+    @client.query("SELECT COUNT(*) AS c FROM mysql2_routing_test").first['c'].should eql(1)
+    @client.stats[:replicas].first[:queries].should eql(0)
+    sleep 0.3
+    @client.pinned?.should be_false
+  end
+
+  it "should run a whole transaction on one primary connection" do
+    @client.query "BEGIN"
+    @client.query "INSERT INTO mysql2_routing_test VALUES (1)"
+    sleep 0.3
+    @client.query("SELECT COUNT(*) AS c FROM mysql2_routing_test").first['c'].should eql(1)
+    @client.query "ROLLBACK"
+    @client.stats[:replicas].first[:queries].should eql(0)
+  end
+
+  it "should take back the connection of a thread that died inside a transaction" do
+    Thread.new { @client.query "BEGIN" }.join
+    Timeout.timeout(5) do
+      @client.query "INSERT INTO mysql2_routing_test VALUES (1)"
+    end
+    @client.stats[:primary][:in_flight].should eql(0)
+  end
+
+  it "should not ping the connection after an SQL error" do
+    @client.query "INSERT INTO mysql2_routing_test VALUES (1)"
+    Mysql2::Client.any_instance.should_not_receive(:ping)
+    lambda { @client.query "INSERT INTO mysql2_routing_no_such_table VALUES (1)" }.should raise_error(Mysql2::Error)
+  end
+
+  it "should not pass one query's options on to the next one on the same connection" do
+    @client.query("SELECT 1 AS one", :as => :array).first.should eql([1])
+    @client.query("SELECT 1 AS one").first.should eql('one' => 1)
+  end
+
+  it "should fall back to the primary when no replica can be reached" do
+    client = Mysql2::RoutingClient.new(:username => "root", :primary => {},
+                                       :replicas => [{ :host => "127.0.0.1", :port => 1 }])
+    client.query("SELECT 1 AS one").first['one'].should eql(1)
+    client.stats[:replicas].first[:healthy].should be_false
+    client.stats[:replicas].first[:failures].should eql(1)
+    client.close
+  end
+end